@@ -0,0 +1,441 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "AsyncIo.h"
+#include "ImageT.h"
+#include "Morphology.h"
+#include "Region.h"
+#include "SceneFile.h"
+#include "Sketch.h"
+#include "Text.h"
+
+// Every benchmark takes (size, bytespp) and works on a size x size image.
+// Results report pixels/s and bytes/s so that runs at different sizes are
+// comparable; use --benchmark_format=json or --benchmark_out=<file> to get
+// output that can be diffed across releases.
+
+static void size_and_format_args(benchmark::internal::Benchmark *b)
+{
+	const int sizes[] = {16, 64, 256, 1024, 4096, 8192};
+	const int formats[] = {Image::GRAYSCALE, Image::RGB, Image::RGBA};
+	for (int s = 0; s < 6; s++)
+		for (int f = 0; f < 3; f++)
+			b->Args({sizes[s], formats[f]});
+}
+
+static void set_counters(benchmark::State &state, int64_t pixels, int64_t bytespp)
+{
+	state.counters["pixels/s"] = benchmark::Counter(pixels * state.iterations(), benchmark::Counter::kIsRate);
+	state.SetBytesProcessed(pixels * bytespp * state.iterations());
+}
+
+static Sketch make_sketch(int size, int bytespp)
+{
+	Sketch sketch(size, size, bytespp);
+	uint8_t *data = sketch.buffer();
+	size_t nbytes = (size_t)size * size * bytespp;
+	for (size_t i = 0; i < nbytes; i++)
+		data[i] = (uint8_t)(i * 31 + (i >> 8));
+	return sketch;
+}
+
+static std::string temp_path(const char *name, int size, int bytespp)
+{
+	const char *dir = getenv("TEST_TMPDIR");
+	if (!dir)
+		dir = getenv("TMPDIR");
+	if (!dir)
+		dir = "/tmp";
+	char file[128];
+	snprintf(file, sizeof(file), "/%s_%d_%d.bmp", name, size, bytespp);
+	return std::string(dir) + file;
+}
+
+static void BM_read_bmp(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	std::string path = temp_path("read", size, bytespp);
+	make_sketch(size, bytespp).write_bmp(path.c_str());
+	for (auto _ : state)
+	{
+		Image image;
+		image.read_bmp(path.c_str());
+		benchmark::DoNotOptimize(image.buffer());
+	}
+	remove(path.c_str());
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_read_bmp)->Apply(size_and_format_args);
+
+static void BM_write_bmp(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	std::string path = temp_path("write", size, bytespp);
+	Sketch sketch = make_sketch(size, bytespp);
+	for (auto _ : state)
+	{
+		sketch.write_bmp(path.c_str());
+	}
+	remove(path.c_str());
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_write_bmp)->Apply(size_and_format_args);
+
+// Batch reads and writes of BATCH_FILES 256 x 256 RGB files, with the queue
+// depth as the argument. Depth 1 behaves like a read_bmp / write_bmp loop.
+#define BATCH_FILES     256
+#define BATCH_SIZE      256
+
+static std::vector<std::string> batch_paths(const char *name)
+{
+	std::vector<std::string> paths;
+	for (int i = 0; i < BATCH_FILES; i++)
+		paths.push_back(temp_path(name, i, Image::RGB));
+	return paths;
+}
+
+static void BM_read_bmps(benchmark::State &state)
+{
+	std::vector<std::string> paths = batch_paths("batch_read");
+	Sketch sketch = make_sketch(BATCH_SIZE, Image::RGB);
+	for (size_t i = 0; i < paths.size(); i++)
+		sketch.write_bmp(paths[i].c_str());
+	std::vector<Image> images;
+	for (auto _ : state)
+	{
+		read_bmps(paths, images, state.range(0));
+		benchmark::DoNotOptimize(images[0].buffer());
+	}
+	for (size_t i = 0; i < paths.size(); i++)
+		remove(paths[i].c_str());
+	set_counters(state, (int64_t)BATCH_FILES * BATCH_SIZE * BATCH_SIZE, Image::RGB);
+}
+BENCHMARK(BM_read_bmps)->Arg(1)->Arg(8)->Arg(64)->UseRealTime();
+
+static void BM_write_bmps(benchmark::State &state)
+{
+	std::vector<std::string> paths = batch_paths("batch_write");
+	std::vector<Image> images(BATCH_FILES, make_sketch(BATCH_SIZE, Image::RGB));
+	for (auto _ : state)
+	{
+		write_bmps(paths, images, state.range(0));
+	}
+	for (size_t i = 0; i < paths.size(); i++)
+		remove(paths[i].c_str());
+	set_counters(state, (int64_t)BATCH_FILES * BATCH_SIZE * BATCH_SIZE, Image::RGB);
+}
+BENCHMARK(BM_write_bmps)->Arg(1)->Arg(8)->Arg(64)->UseRealTime();
+
+static void BM_to_rgb(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch source = make_sketch(size, bytespp);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		Sketch sketch(source);
+		state.ResumeTiming();
+		sketch.to_rgb();
+		benchmark::DoNotOptimize(sketch.buffer());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_to_rgb)->Apply(size_and_format_args);
+
+static void BM_flip_horizontally(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	for (auto _ : state)
+	{
+		sketch.flip_horizontally();
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_flip_horizontally)->Apply(size_and_format_args);
+
+static void BM_flip_vertically(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	for (auto _ : state)
+	{
+		sketch.flip_vertically();
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_flip_vertically)->Apply(size_and_format_args);
+
+static void BM_scale(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch source = make_sketch(size, bytespp);
+	for (auto _ : state)
+	{
+		state.PauseTiming();
+		Sketch sketch(source);
+		state.ResumeTiming();
+		sketch.scale(size / 2 + 1, size * 2);
+		benchmark::DoNotOptimize(sketch.buffer());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_scale)->Apply(size_and_format_args);
+
+// Lines fan out from the top left corner to every pixel of the bottom and
+// right edges, covering all slopes in the first octants.
+template <bool (Sketch::*Draw)(int, int, int, int, Colour)>
+static void BM_draw_line(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	Colour colour(WHITE, bytespp);
+	for (auto _ : state)
+	{
+		for (int i = 0; i < size; i++)
+		{
+			(sketch.*Draw)(0, 0, i, size - 1, colour);
+			(sketch.*Draw)(size - 1, i, 0, 0, colour);
+		}
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, 2 * (int64_t)size * size, bytespp);
+}
+BENCHMARK_TEMPLATE(BM_draw_line, &Sketch::draw_line)->Apply(size_and_format_args);
+BENCHMARK_TEMPLATE(BM_draw_line, &Sketch::draw_line2)->Apply(size_and_format_args);
+BENCHMARK_TEMPLATE(BM_draw_line, &Sketch::draw_line3)->Apply(size_and_format_args);
+
+static void BM_draw_triangle(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	Colour colour(RED, bytespp);
+	Vector2i t0(0, 0), t1(size - 1, size / 3), t2(size / 4, size - 1);
+	for (auto _ : state)
+	{
+		sketch.draw_triangle(t0, t1, t2, colour);
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size / 2, bytespp);
+}
+BENCHMARK(BM_draw_triangle)->Apply(size_and_format_args);
+
+static void BM_draw_image(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	Sketch inner = make_sketch(size / 2, bytespp);
+	for (auto _ : state)
+	{
+		sketch.draw_image(inner, size / 4, size / 4);
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)(size / 2) * (size / 2), bytespp);
+}
+BENCHMARK(BM_draw_image)->Apply(size_and_format_args);
+
+// A grid of small triangles two pixels apart, so both operations see many
+// regions and run boundaries.
+static Sketch make_mask(int size, int bytespp)
+{
+	Sketch mask(size, size, bytespp);
+	mask.fill(Colour(BLACK, bytespp));
+	for (int y = 0; y < size; y += 10)
+		for (int x = 0; x < size; x += 10)
+			mask.draw_triangle(Vector2i(x, y), Vector2i(x + 8, y), Vector2i(x, y + 8), Colour(WHITE, bytespp));
+	return mask;
+}
+
+static void BM_flood_fill(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch mask = make_mask(size, bytespp);
+	Colour colours[2] = {Colour(RED, bytespp), Colour(BLUE, bytespp)};
+	int i = 0;
+	for (auto _ : state)
+	{
+		mask.flood_fill(9, 9, colours[i++ & 1]);
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_flood_fill)->Apply(size_and_format_args);
+
+static void BM_label_components(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch mask = make_mask(size, bytespp);
+	Labels labels;
+	for (auto _ : state)
+	{
+		label_components(mask, labels);
+		benchmark::DoNotOptimize(labels.labels.data());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_label_components)->Apply(size_and_format_args);
+
+// Radius 7, so a naive 15x15 window would cost 225 comparisons per channel.
+static void BM_dilate(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch mask = make_mask(size, bytespp);
+	for (auto _ : state)
+	{
+		Image img = mask;
+		dilate(img, 7, 7);
+		benchmark::DoNotOptimize(img.buffer());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_dilate)->Apply(size_and_format_args);
+
+static void BM_signed_distance(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch mask = make_mask(size, bytespp);
+	ImageF sdf;
+	for (auto _ : state)
+	{
+		signed_distance(mask, sdf);
+		benchmark::DoNotOptimize(sdf.buffer());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_signed_distance)->Apply(size_and_format_args);
+
+// Labels on a grid covering the canvas, drawn one call per label or as one
+// batch.
+static void BM_draw_text(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	Colour colour(BLACK, bytespp);
+	char label[16];
+	for (auto _ : state)
+	{
+		for (int y = 0; y + FONT_LINE_HEIGHT <= size; y += FONT_LINE_HEIGHT)
+			for (int x = 0; x + 8 * FONT_ADVANCE <= size; x += 8 * FONT_ADVANCE)
+			{
+				snprintf(label, sizeof(label), "%03d,%03d", x % 1000, y % 1000);
+				sketch.draw_text(x, y, label, colour);
+			}
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_draw_text)->Apply(size_and_format_args);
+
+static void BM_draw_text_batch(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	TextBatch batch(GlyphAtlas::shared(1));
+	char label[16];
+	for (auto _ : state)
+	{
+		batch.clear();
+		for (int y = 0; y + FONT_LINE_HEIGHT <= size; y += FONT_LINE_HEIGHT)
+			for (int x = 0; x + 8 * FONT_ADVANCE <= size; x += 8 * FONT_ADVANCE)
+			{
+				snprintf(label, sizeof(label), "%03d,%03d", x % 1000, y % 1000);
+				batch.add(x, y, label);
+			}
+		batch.draw(sketch, BLACK);
+		benchmark::ClobberMemory();
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK(BM_draw_text_batch)->Apply(size_and_format_args);
+
+// A 256x256 scene of n small triangles, as text, so that the cost of getting
+// a scene ready to draw can be compared between the two formats.
+static std::string make_scene_text(int n)
+{
+	std::string text = "canvas 256 256 3\n";
+	char line[128];
+	for (int i = 0; i < n; i++)
+	{
+		int x = (i * 37) % 240, y = (i * 101) % 240;
+		snprintf(line, sizeof(line), "triangle %d %d %d %d %d %d %d %d %d\n", x, y, x + 15, y + 4, x + 3, y + 12,
+		         i & 255, (i >> 3) & 255, 200);
+		text += line;
+	}
+	return text;
+}
+
+static void BM_parse_scene(benchmark::State &state)
+{
+	std::string text = make_scene_text(state.range(0));
+	std::string error;
+	for (auto _ : state)
+	{
+		Scene scene;
+		parse_scene(text.data(), text.size(), scene, error);
+		benchmark::DoNotOptimize(scene.ops.data());
+	}
+	state.SetItemsProcessed(state.range(0) * state.iterations());
+}
+BENCHMARK(BM_parse_scene)->Arg(1024)->Arg(65536);
+
+static void BM_load_scene_file(benchmark::State &state)
+{
+	std::string text = make_scene_text(state.range(0));
+	std::string error;
+	Scene scene;
+	parse_scene(text.data(), text.size(), scene, error);
+	std::vector<uint8_t> bytes;
+	encode_scene_file(scene, bytes);
+	for (auto _ : state)
+	{
+		SceneFile file;
+		file.load(bytes.data(), bytes.size(), error);
+		benchmark::DoNotOptimize(file.commands());
+	}
+	state.SetItemsProcessed(state.range(0) * state.iterations());
+}
+BENCHMARK(BM_load_scene_file)->Arg(1024)->Arg(65536);
+
+// Widening to T and narrowing back to 8 bits, as done at both ends of a
+// high bit depth pipeline.
+template <typename T>
+static void BM_widen_narrow(benchmark::State &state)
+{
+	int size = state.range(0);
+	int bytespp = state.range(1);
+	Sketch sketch = make_sketch(size, bytespp);
+	ImageT<T> wide;
+	Image narrow;
+	for (auto _ : state)
+	{
+		wide.from_image(sketch);
+		wide.to_image(narrow);
+		benchmark::DoNotOptimize(narrow.buffer());
+	}
+	set_counters(state, (int64_t)size * size, bytespp);
+}
+BENCHMARK_TEMPLATE(BM_widen_narrow, uint16_t)->Apply(size_and_format_args);
+BENCHMARK_TEMPLATE(BM_widen_narrow, float)->Apply(size_and_format_args);
+
+BENCHMARK_MAIN();
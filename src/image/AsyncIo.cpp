@@ -0,0 +1,672 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+#include "AsyncIo.h"
+#include "BlockingQueue.h"
+#include "Profile.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define ASYNC_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Largest single read or write; the ring takes 32-bit lengths.
+#define MAX_TRANSFER        (1u << 30)
+
+struct IoJob
+{
+	bool write;
+	std::string path;
+	uint64_t tag;
+	std::vector<uint8_t> bytes;
+};
+
+class IoBackend
+{
+public:
+	virtual ~IoBackend() {}
+	virtual const char *name() const = 0;
+	virtual void submit(IoJob &job) = 0;
+	// Only called with at least one job in flight.
+	virtual void wait(IoResult &result) = 0;
+};
+
+static bool read_file(const std::string &path, std::vector<uint8_t> &bytes)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	bytes.resize(st.st_size);
+	size_t done = 0;
+	while (done < bytes.size())
+	{
+		ssize_t n = pread(fd, &bytes[done], std::min(bytes.size() - done, (size_t)MAX_TRANSFER), done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+		{
+			close(fd);
+			return false;
+		}
+		if (n == 0)
+			break;
+		done += n;
+	}
+	bytes.resize(done);
+	close(fd);
+	return true;
+}
+
+static bool write_file(const std::string &path, const std::vector<uint8_t> &bytes)
+{
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0)
+		return false;
+
+	size_t done = 0;
+	while (done < bytes.size())
+	{
+		ssize_t n = pwrite(fd, &bytes[done], std::min(bytes.size() - done, (size_t)MAX_TRANSFER), done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			close(fd);
+			return false;
+		}
+		done += n;
+	}
+	return close(fd) == 0;
+}
+
+// One thread per request slot, each doing ordinary blocking I/O.
+class ThreadBackend : public IoBackend
+{
+	BlockingQueue<IoJob> jobs;
+	BlockingQueue<IoResult> done;
+	std::vector<std::thread> workers;
+
+	void run()
+	{
+		IoJob job;
+		while (jobs.pop(job))
+		{
+			IoResult result;
+			result.tag = job.tag;
+			if (job.write)
+			{
+				result.ok = write_file(job.path, job.bytes);
+			}
+			else
+			{
+				result.ok = read_file(job.path, job.bytes);
+				result.bytes.swap(job.bytes);
+			}
+			job.bytes.clear();
+			done.push(result);
+		}
+	}
+
+public:
+	ThreadBackend(int threads)
+	{
+		for (int i = 0; i < threads; i++)
+			workers.push_back(std::thread(&ThreadBackend::run, this));
+	}
+
+	~ThreadBackend()
+	{
+		jobs.close();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	const char *name() const
+	{
+		return "threads";
+	}
+
+	void submit(IoJob &job)
+	{
+		jobs.push(job);
+	}
+
+	void wait(IoResult &result)
+	{
+		done.pop(result);
+	}
+};
+
+#ifdef ASYNC_IO_URING
+// io_uring through the raw system calls, so there is no liburing dependency.
+// Every request is an open followed by as many reads or writes as it takes,
+// and has at most one entry in the ring at a time; the descriptor is closed
+// synchronously, which never blocks on the disk.
+class UringBackend : public IoBackend
+{
+	struct Op
+	{
+		IoJob job;
+		int file;			// -1 until the open completes
+		size_t done;
+	};
+
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	io_uring_sqe *sqes;
+	io_uring_cqe *cqes;
+	void *sq_ring;
+	size_t sq_size;
+	void *cq_ring;
+	size_t cq_size;
+	size_t sqes_size;
+	unsigned unsubmitted;
+	std::unordered_set<Op *> live;
+	std::deque<IoResult> finished;
+
+	UringBackend() : fd(-1), sqes((io_uring_sqe *)MAP_FAILED), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), unsubmitted(0)
+	{
+	}
+
+	bool setup(unsigned depth)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+		if (fd < 0)
+			return false;
+
+		sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single)
+			sq_size = cq_size = std::max(sq_size, cq_size);
+		sq_ring = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (sq_ring == MAP_FAILED)
+			return false;
+		if (single)
+			cq_ring = sq_ring;
+		else
+			cq_ring = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+			return false;
+		sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = (io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED)
+			return false;
+
+		uint8_t *sq = (uint8_t *)sq_ring;
+		uint8_t *cq = (uint8_t *)cq_ring;
+		sq_tail = (unsigned *)(sq + p.sq_off.tail);
+		sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+		sq_array = (unsigned *)(sq + p.sq_off.array);
+		cq_head = (unsigned *)(cq + p.cq_off.head);
+		cq_tail = (unsigned *)(cq + p.cq_off.tail);
+		cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+		cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+		return supported();
+	}
+
+	// Kernels before 5.6 have a ring but cannot open or read through it.
+	bool supported()
+	{
+		std::vector<uint8_t> buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+		io_uring_probe *probe = (io_uring_probe *)&buf[0];
+		if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+			return false;
+		const int needed[] = {IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE};
+		for (int i = 0; i < 3; i++)
+			if (needed[i] >= probe->ops_len || !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED))
+				return false;
+		return true;
+	}
+
+	// Only this thread moves the tail, and in-flight requests never exceed
+	// the ring size, so there is always a free entry.
+	io_uring_sqe *next_sqe(Op *op)
+	{
+		unsigned tail = *sq_tail;
+		unsigned index = tail & *sq_mask;
+		io_uring_sqe *sqe = &sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->user_data = (uint64_t)(uintptr_t)op;
+		sq_array[index] = index;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		unsubmitted++;
+		return sqe;
+	}
+
+	void prep_transfer(Op *op)
+	{
+		io_uring_sqe *sqe = next_sqe(op);
+		sqe->opcode = op->job.write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = op->file;
+		sqe->addr = (uint64_t)(uintptr_t)(&op->job.bytes[0] + op->done);
+		sqe->len = (uint32_t)std::min(op->job.bytes.size() - op->done, (size_t)MAX_TRANSFER);
+		sqe->off = op->done;
+	}
+
+	void finish(Op *op, bool ok)
+	{
+		if (op->file >= 0 && close(op->file) != 0)
+			ok = false;
+		IoResult result;
+		result.tag = op->job.tag;
+		result.ok = ok;
+		if (!op->job.write)
+			result.bytes.swap(op->job.bytes);
+		finished.push_back(std::move(result));
+		live.erase(op);
+		delete op;
+	}
+
+	void complete(Op *op, int res)
+	{
+		if (res < 0)
+			return finish(op, false);
+
+		if (op->file < 0)
+		{
+			op->file = res;
+			if (!op->job.write)
+			{
+				struct stat st;
+				if (fstat(op->file, &st) != 0)
+					return finish(op, false);
+				op->job.bytes.resize(st.st_size);
+			}
+		}
+		else if (res == 0)
+		{
+			// A file that shrank while being read ends early.
+			if (op->job.write)
+				return finish(op, false);
+			op->job.bytes.resize(op->done);
+		}
+		else
+		{
+			op->done += res;
+		}
+
+		if (op->done < op->job.bytes.size())
+			prep_transfer(op);
+		else
+			finish(op, true);
+	}
+
+	// Submits the prepared entries and, with wait set, blocks for at least
+	// one completion. A ring that fails outright fails every request; their
+	// buffers are leaked, as the kernel may still be using them.
+	void enter(bool wait)
+	{
+		for (;;)
+		{
+			int n = (int)syscall(__NR_io_uring_enter, fd, unsubmitted, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+			if (n >= 0)
+			{
+				unsubmitted -= std::min((unsigned)n, unsubmitted);
+				return;
+			}
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+
+			std::cerr << "io_uring_enter failed: " << strerror(errno) << std::endl;
+			for (std::unordered_set<Op *>::iterator it = live.begin(); it != live.end(); ++it)
+			{
+				IoResult result;
+				result.tag = (*it)->job.tag;
+				result.ok = false;
+				finished.push_back(std::move(result));
+			}
+			live.clear();
+			unsubmitted = 0;
+			return;
+		}
+	}
+
+	void reap()
+	{
+		unsigned head = *cq_head;
+		unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++)
+		{
+			io_uring_cqe *cqe = &cqes[head & *cq_mask];
+			complete((Op *)(uintptr_t)cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+	}
+
+public:
+	static UringBackend *create(int depth)
+	{
+		UringBackend *ring = new UringBackend();
+		if (!ring->setup(depth))
+		{
+			delete ring;
+			return NULL;
+		}
+		return ring;
+	}
+
+	~UringBackend()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqes_size);
+		if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+			munmap(cq_ring, cq_size);
+		if (sq_ring != MAP_FAILED)
+			munmap(sq_ring, sq_size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	const char *name() const
+	{
+		return "io_uring";
+	}
+
+	void submit(IoJob &job)
+	{
+		Op *op = new Op();
+		op->job.write = job.write;
+		op->job.path.swap(job.path);
+		op->job.tag = job.tag;
+		op->job.bytes.swap(job.bytes);
+		op->file = -1;
+		op->done = 0;
+		live.insert(op);
+
+		io_uring_sqe *sqe = next_sqe(op);
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (uint64_t)(uintptr_t)op->job.path.c_str();
+		if (op->job.write)
+		{
+			sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+			sqe->len = 0666;
+		}
+		else
+		{
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		enter(false);
+	}
+
+	void wait(IoResult &result)
+	{
+		while (finished.empty())
+		{
+			enter(true);
+			reap();
+		}
+		// Follow-up reads and writes queued while reaping.
+		if (unsubmitted > 0)
+			enter(false);
+		result = std::move(finished.front());
+		finished.pop_front();
+	}
+};
+#endif
+
+static IoBackend *make_backend(int depth)
+{
+	const char *forced = getenv("IMAGE_IO");
+	if (forced && strcmp(forced, "threads") != 0 && strcmp(forced, "io_uring") != 0)
+		std::cerr << "Unknown IMAGE_IO " << forced << std::endl;
+#ifdef ASYNC_IO_URING
+	if (!forced || strcmp(forced, "threads") != 0)
+	{
+		IoBackend *ring = UringBackend::create(depth);
+		if (ring)
+			return ring;
+	}
+#endif
+	return new ThreadBackend(depth);
+}
+
+AsyncIo::AsyncIo(int depth) : depth(std::max(depth, 1)), pending(0)
+{
+	backend = make_backend(this->depth);
+}
+
+AsyncIo::~AsyncIo()
+{
+	IoResult result;
+	while (wait(result))
+	{
+	}
+	delete backend;
+}
+
+const char *AsyncIo::backend_name() const
+{
+	return backend->name();
+}
+
+int AsyncIo::get_depth() const
+{
+	return depth;
+}
+
+int AsyncIo::in_flight() const
+{
+	return pending;
+}
+
+bool AsyncIo::read(const std::string &path, uint64_t tag)
+{
+	if (pending >= depth)
+		return false;
+	IoJob job;
+	job.write = false;
+	job.path = path;
+	job.tag = tag;
+	backend->submit(job);
+	pending++;
+	return true;
+}
+
+bool AsyncIo::write(const std::string &path, std::vector<uint8_t> &bytes, uint64_t tag)
+{
+	if (pending >= depth)
+		return false;
+	IoJob job;
+	job.write = true;
+	job.path = path;
+	job.tag = tag;
+	job.bytes.swap(bytes);
+	backend->submit(job);
+	pending++;
+	return true;
+}
+
+bool AsyncIo::wait(IoResult &result)
+{
+	if (pending == 0)
+		return false;
+	backend->wait(result);
+	pending--;
+	return true;
+}
+
+static int worker_count()
+{
+	int threads = std::thread::hardware_concurrency();
+	return threads < 1 ? 1 : threads;
+}
+
+// Completed reads are handed to one decoder per core. Reads in flight plus
+// files waiting to be decoded stay within depth, which bounds the memory held
+// when the disks outrun the decoders.
+size_t read_bmps(const std::vector<std::string> &paths, std::vector<Image> &images, int depth)
+{
+	PROFILE_SCOPE(OP_READ_BMP);
+	images.assign(paths.size(), Image());
+	AsyncIo io(depth);
+	depth = io.get_depth();
+
+	BlockingQueue<IoResult> queue;
+	std::mutex lock;
+	std::condition_variable room;
+	int waiting = 0;
+	std::atomic<size_t> decoded(0);
+
+	std::vector<std::thread> decoders;
+	for (int i = worker_count(); i > 0; i--)
+	{
+		decoders.push_back(std::thread([&] {
+			IoResult result;
+			while (queue.pop(result))
+			{
+				Image &image = images[result.tag];
+				image.decode_bmp(&result.bytes[0], result.bytes.size());
+				if (image.buffer())
+					decoded++;
+				result.bytes.clear();
+				{
+					std::lock_guard<std::mutex> guard(lock);
+					waiting--;
+				}
+				room.notify_one();
+			}
+		}));
+	}
+
+	size_t next = 0;
+	while (next < paths.size() || io.in_flight() > 0)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			if (io.in_flight() == 0)
+				room.wait(guard, [&] { return waiting < depth; });
+			while (next < paths.size() && io.in_flight() + waiting < depth)
+			{
+				io.read(paths[next], next);
+				next++;
+			}
+		}
+
+		IoResult result;
+		if (!io.wait(result))
+			continue;
+		if (!result.ok || result.bytes.empty())
+		{
+			std::cerr << "Could not read file " << paths[result.tag] << std::endl;
+			continue;
+		}
+		PROFILE_BYTES_READ(result.bytes.size());
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			waiting++;
+		}
+		queue.push(result);
+	}
+
+	queue.close();
+	for (size_t i = 0; i < decoders.size(); i++)
+		decoders[i].join();
+	return decoded;
+}
+
+// The reverse pipeline: one encoder per core fills a queue of finished files
+// that this thread submits as writes. Encoded files not yet written stay
+// within depth.
+size_t write_bmps(const std::vector<std::string> &paths, const std::vector<Image> &images, int depth)
+{
+	PROFILE_SCOPE(OP_WRITE_BMP);
+	size_t n = std::min(paths.size(), images.size());
+	AsyncIo io(depth);
+	depth = io.get_depth();
+
+	BlockingQueue<IoResult> queue;
+	std::mutex lock;
+	std::condition_variable room;
+	int slots = depth;
+	std::atomic<size_t> next(0);
+
+	std::vector<std::thread> encoders;
+	for (int i = worker_count(); i > 0; i--)
+	{
+		encoders.push_back(std::thread([&] {
+			for (;;)
+			{
+				{
+					std::unique_lock<std::mutex> guard(lock);
+					room.wait(guard, [&] { return slots > 0; });
+					slots--;
+				}
+				IoResult result;
+				result.tag = next++;
+				if (result.tag >= n)
+				{
+					{
+						std::lock_guard<std::mutex> guard(lock);
+						slots++;
+					}
+					room.notify_all();
+					return;
+				}
+				images[result.tag].encode_bmp(result.bytes);
+				result.ok = true;
+				queue.push(result);
+			}
+		}));
+	}
+
+	size_t submitted = 0;
+	size_t written = 0;
+	while (submitted < n || io.in_flight() > 0)
+	{
+		IoResult result;
+		if (submitted < n && (io.in_flight() == 0 ? queue.pop(result) : queue.try_pop(result)))
+		{
+			PROFILE_BYTES_WRITTEN(result.bytes.size());
+			io.write(paths[result.tag], result.bytes, result.tag);
+			submitted++;
+			continue;
+		}
+
+		io.wait(result);
+		if (result.ok)
+			written++;
+		else
+			std::cerr << "Could not write file " << paths[result.tag] << std::endl;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			slots++;
+		}
+		room.notify_one();
+	}
+
+	for (size_t i = 0; i < encoders.size(); i++)
+		encoders[i].join();
+	return written;
+}
@@ -0,0 +1,63 @@
+#ifndef __ASYNC_IO_H__
+#define __ASYNC_IO_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+
+#define ASYNC_IO_DEPTH      64
+
+// Whole-file reads and writes with many requests in flight at once, so batch
+// jobs keep fast disks busy instead of waiting on one file at a time. On
+// Linux the requests go through an io_uring; where the kernel lacks one, or
+// IMAGE_IO is set to threads, a pool of threads does blocking I/O instead.
+
+struct IoResult
+{
+	uint64_t tag;						// As passed to read or write
+	bool ok;
+	std::vector<uint8_t> bytes;		// The file contents, for a read
+};
+
+class IoBackend;
+
+class AsyncIo
+{
+	IoBackend *backend;
+	int depth;
+	int pending;
+
+	AsyncIo(const AsyncIo &);
+	AsyncIo &operator=(const AsyncIo &);
+
+public:
+	explicit AsyncIo(int depth = ASYNC_IO_DEPTH);
+	~AsyncIo();
+
+	// "io_uring" or "threads".
+	const char *backend_name() const;
+	int get_depth() const;
+	int in_flight() const;
+
+	// Queue a read of the whole file, or a write replacing it with bytes,
+	// which are taken over by the request. Both fail when depth requests are
+	// already in flight.
+	bool read(const std::string &path, uint64_t tag);
+	bool write(const std::string &path, std::vector<uint8_t> &bytes, uint64_t tag);
+
+	// Waits for the next request to finish, in whatever order they do.
+	// Returns false when nothing is in flight.
+	bool wait(IoResult &result);
+};
+
+// Batch versions of read_bmp and write_bmp. Files are decoded or encoded on
+// every core while up to depth reads or writes are in flight. images[i] is
+// read from or written to paths[i]; failures print an error, leave an empty
+// image behind for reads, and are left out of the returned count. The
+// decoded image cache is not consulted.
+size_t read_bmps(const std::vector<std::string> &paths, std::vector<Image> &images, int depth = ASYNC_IO_DEPTH);
+size_t write_bmps(const std::vector<std::string> &paths, const std::vector<Image> &images, int depth = ASYNC_IO_DEPTH);
+
+#endif //__ASYNC_IO_H__
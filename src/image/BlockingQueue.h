@@ -0,0 +1,65 @@
+#ifndef __BLOCKING_QUEUE_H__
+#define __BLOCKING_QUEUE_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Unbounded queue handing work between threads. Closing it wakes every
+// waiting consumer; items already queued can still be popped.
+template <typename T>
+class BlockingQueue
+{
+	std::mutex lock;
+	std::condition_variable ready;
+	std::deque<T> items;
+	bool closed;
+
+public:
+	BlockingQueue() : closed(false)
+	{
+	}
+
+	void push(T &item)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			items.push_back(std::move(item));
+		}
+		ready.notify_one();
+	}
+
+	// Blocks until there is an item, or returns false once the queue is
+	// closed and empty.
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		ready.wait(guard, [this] { return !items.empty() || closed; });
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+	bool try_pop(T &item)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+	void close()
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closed = true;
+		}
+		ready.notify_all();
+	}
+};
+
+#endif //__BLOCKING_QUEUE_H__
@@ -0,0 +1,412 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Compare.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+// SSIM constants for 8-bit samples, (k * 255)^2 with k1 = 0.01, k2 = 0.03
+#define SSIM_C1   6.5025
+#define SSIM_C2   58.5225
+
+struct DiffStats
+{
+	uint32_t max[RGBAQUAD];
+	uint64_t abs[RGBAQUAD];
+	uint64_t sq[RGBAQUAD];
+	uint64_t differing;
+
+	DiffStats()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	void merge(const DiffStats &s)
+	{
+		for (int c = 0; c < RGBAQUAD; c++)
+		{
+			max[c] = std::max(max[c], s.max[c]);
+			abs[c] += s.abs[c];
+			sq[c] += s.sq[c];
+		}
+		differing += s.differing;
+	}
+};
+
+// Sums for one 4x4 block of one channel: s1 and s2 of each image, ss of
+// both images' squares and s12 of their products.
+struct BlockSums
+{
+	uint32_t s1, s2, ss, s12;
+};
+
+CompareResult::CompareResult() : width(0), height(0), channels(0), psnr_total(0.0), ssim(0.0), differing_pixels(0)
+{
+	for (int c = 0; c < RGBAQUAD; c++)
+	{
+		max_error[c] = 0;
+		mean_error[c] = 0.0;
+		psnr[c] = 0.0;
+	}
+}
+
+bool CompareResult::identical() const
+{
+	return channels > 0 && differing_pixels == 0;
+}
+
+// Accumulates n pixels of C channels. The SSE2 path works on 16 pixels at a
+// time, C registers of 16 bytes, and folds its lanes back onto channels at
+// the end of the row; byte i of the block belongs to channel i % C.
+template <int C>
+static void diff_row(const uint8_t *a, const uint8_t *b, int n, DiffStats &s)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	while (x + 16 <= n)
+	{
+		// 16-bit sums of absolute differences overflow after 257 blocks
+		int blocks = std::min((n - x) / 16, 256);
+		__m128i mx[C], ab[C][2], sq[C][4];
+		for (int r = 0; r < C; r++)
+		{
+			mx[r] = zero;
+			ab[r][0] = ab[r][1] = zero;
+			sq[r][0] = sq[r][1] = sq[r][2] = sq[r][3] = zero;
+		}
+		for (int k = 0; k < blocks; k++, x += 16)
+		{
+			for (int r = 0; r < C; r++)
+			{
+				__m128i va = _mm_loadu_si128((const __m128i *)(a + x * C + 16 * r));
+				__m128i vb = _mm_loadu_si128((const __m128i *)(b + x * C + 16 * r));
+				__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+				mx[r] = _mm_max_epu8(mx[r], d);
+				__m128i lo = _mm_unpacklo_epi8(d, zero);
+				__m128i hi = _mm_unpackhi_epi8(d, zero);
+				ab[r][0] = _mm_add_epi16(ab[r][0], lo);
+				ab[r][1] = _mm_add_epi16(ab[r][1], hi);
+				lo = _mm_mullo_epi16(lo, lo);
+				hi = _mm_mullo_epi16(hi, hi);
+				sq[r][0] = _mm_add_epi32(sq[r][0], _mm_unpacklo_epi16(lo, zero));
+				sq[r][1] = _mm_add_epi32(sq[r][1], _mm_unpackhi_epi16(lo, zero));
+				sq[r][2] = _mm_add_epi32(sq[r][2], _mm_unpacklo_epi16(hi, zero));
+				sq[r][3] = _mm_add_epi32(sq[r][3], _mm_unpackhi_epi16(hi, zero));
+			}
+		}
+		for (int r = 0; r < C; r++)
+		{
+			uint8_t m[16];
+			uint16_t a16[16];
+			uint32_t s32[16];
+			_mm_storeu_si128((__m128i *)m, mx[r]);
+			_mm_storeu_si128((__m128i *)a16, ab[r][0]);
+			_mm_storeu_si128((__m128i *)(a16 + 8), ab[r][1]);
+			for (int q = 0; q < 4; q++)
+				_mm_storeu_si128((__m128i *)(s32 + 4 * q), sq[r][q]);
+			for (int l = 0; l < 16; l++)
+			{
+				int c = (16 * r + l) % C;
+				s.max[c] = std::max(s.max[c], (uint32_t)m[l]);
+				s.abs[c] += a16[l];
+				s.sq[c] += s32[l];
+			}
+		}
+	}
+#endif
+	for (; x < n; x++)
+	{
+		for (int c = 0; c < C; c++)
+		{
+			int d = abs(a[x * C + c] - b[x * C + c]);
+			s.max[c] = std::max(s.max[c], (uint32_t)d);
+			s.abs[c] += d;
+			s.sq[c] += d * d;
+		}
+	}
+}
+
+static void diff_row(const uint8_t *a, const uint8_t *b, int n, int channels, DiffStats &s)
+{
+	uint64_t before = 0, after = 0;
+	for (int c = 0; c < channels; c++)
+		before += s.abs[c];
+
+	switch (channels)
+	{
+	case 1:
+		diff_row<1>(a, b, n, s);
+		break;
+	case 3:
+		diff_row<3>(a, b, n, s);
+		break;
+	default:
+		diff_row<4>(a, b, n, s);
+	}
+
+	for (int c = 0; c < channels; c++)
+		after += s.abs[c];
+	if (after == before)
+		return;
+	for (int x = 0; x < n; x++)
+		if (memcmp(a + x * channels, b + x * channels, channels) != 0)
+			s.differing++;
+}
+
+static void block_sums(const uint8_t *a, size_t sa, const uint8_t *b, size_t sb, int blocks, int channels, BlockSums *out)
+{
+	for (int bx = 0; bx < blocks; bx++)
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			BlockSums s = {0, 0, 0, 0};
+			for (int y = 0; y < 4; y++)
+			{
+				const uint8_t *pa = a + y * sa + bx * 4 * channels + c;
+				const uint8_t *pb = b + y * sb + bx * 4 * channels + c;
+				for (int x = 0; x < 4; x++)
+				{
+					uint32_t va = pa[x * channels];
+					uint32_t vb = pb[x * channels];
+					s.s1 += va;
+					s.s2 += vb;
+					s.ss += va * va + vb * vb;
+					s.s12 += va * vb;
+				}
+			}
+			out[bx * channels + c] = s;
+		}
+	}
+}
+
+static double ssim_window(double s1, double s2, double ss, double s12, double n)
+{
+	double mu1 = s1 / n;
+	double mu2 = s2 / n;
+	double var = ss / n - mu1 * mu1 - mu2 * mu2;		// Sum of both variances
+	double cov = s12 / n - mu1 * mu2;
+	return ((2.0 * mu1 * mu2 + SSIM_C1) * (2.0 * cov + SSIM_C2)) /
+	       ((mu1 * mu1 + mu2 * mu2 + SSIM_C1) * (var + SSIM_C2));
+}
+
+// 8x8 windows at a stride of 4, each built from four 4x4 block sums, so
+// every sample is summed once per block rather than once per window.
+// Images too small for one window are treated as a single window.
+static double ssim(const uint8_t *a, size_t sa, const uint8_t *b, size_t sb, int w, int h, int channels)
+{
+	size_t line = (size_t)w * channels;
+	int bw = w / 4;
+	int bh = h / 4;
+	if (bw < 2 || bh < 2)
+	{
+		double total = 0.0;
+		for (int c = 0; c < channels; c++)
+		{
+			double s1 = 0, s2 = 0, ss = 0, s12 = 0;
+			for (int y = 0; y < h; y++)
+			{
+				const uint8_t *ra = a + y * sa;
+				const uint8_t *rb = b + y * sb;
+				for (size_t i = c; i < line; i += channels)
+				{
+					s1 += ra[i];
+					s2 += rb[i];
+					ss += ra[i] * ra[i] + rb[i] * rb[i];
+					s12 += ra[i] * rb[i];
+				}
+			}
+			total += ssim_window(s1, s2, ss, s12, (double)w * h);
+		}
+		return total / channels;
+	}
+
+	double total = 0.0;
+	std::mutex lock;
+	parallel_bands(bh - 1, [&](int begin, int end) {
+		std::vector<BlockSums> rows[2];
+		rows[0].resize(bw * channels);
+		rows[1].resize(bw * channels);
+		block_sums(a + begin * 4 * sa, sa, b + begin * 4 * sb, sb, bw, channels, &rows[0][0]);
+		double sum = 0.0;
+		for (int by = begin; by < end; by++)
+		{
+			const BlockSums *top = &rows[(by - begin) & 1][0];
+			BlockSums *bottom = &rows[(by - begin + 1) & 1][0];
+			block_sums(a + (by + 1) * 4 * sa, sa, b + (by + 1) * 4 * sb, sb, bw, channels, bottom);
+			for (int bx = 0; bx < bw - 1; bx++)
+			{
+				for (int c = 0; c < channels; c++)
+				{
+					const BlockSums &p = top[bx * channels + c];
+					const BlockSums &q = top[(bx + 1) * channels + c];
+					const BlockSums &r = bottom[bx * channels + c];
+					const BlockSums &t = bottom[(bx + 1) * channels + c];
+					sum += ssim_window(p.s1 + q.s1 + r.s1 + t.s1, p.s2 + q.s2 + r.s2 + t.s2,
+					                   p.ss + q.ss + r.ss + t.ss, p.s12 + q.s12 + r.s12 + t.s12, 64.0);
+				}
+			}
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		total += sum;
+	});
+	return total / ((double)(bw - 1) * (bh - 1) * channels);
+}
+
+static double psnr(double mse)
+{
+	return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+}
+
+// Widens img to the given number of channels, converting a copy in tmp when
+// it does not already match. Indexed colour images always go through tmp.
+static const Image *with_channels(const Image &img, Image &tmp, int channels)
+{
+	bool indexed = img.get_bytespp()==1 && !img.is_grayscale();
+	if (img.get_bytespp()==channels && !indexed)
+		return &img;
+	tmp = img;
+	if (channels==Image::RGBA)
+		tmp.to_rgba();
+	else
+		tmp.to_rgb();
+	return &tmp;
+}
+
+static int common_channels(const Image &a, const Image &b)
+{
+	int ca = a.get_bytespp()==1 && !a.is_grayscale() ? Image::RGB : a.get_bytespp();
+	int cb = b.get_bytespp()==1 && !b.is_grayscale() ? Image::RGB : b.get_bytespp();
+	return std::max(ca, cb);
+}
+
+bool compare(const Image &a, const Image &b, CompareResult &result)
+{
+	try
+	{
+		if (!a.buffer() || !b.buffer())
+			throw "Nothing to compare";
+		if (a.get_width()!=b.get_width() || a.get_height()!=b.get_height())
+			throw "Images differ in size";
+		PROFILE_SCOPE(OP_COMPARE);
+
+		Image ta, tb;
+		int channels = common_channels(a, b);
+		const Image *pa = with_channels(a, ta, channels);
+		const Image *pb = with_channels(b, tb, channels);
+		int w = a.get_width();
+		int h = a.get_height();
+		size_t sa = pa->get_stride();
+		size_t sb = pb->get_stride();
+		const uint8_t *da = pa->buffer();
+		const uint8_t *db = pb->buffer();
+		PROFILE_PIXELS((uint64_t)w * h);
+
+		DiffStats total;
+		std::mutex lock;
+		parallel_bands(h, [&](int begin, int end) {
+			DiffStats local;
+			for (int y = begin; y < end; y++)
+				diff_row(da + y * sa, db + y * sb, w, channels, local);
+			std::lock_guard<std::mutex> guard(lock);
+			total.merge(local);
+		});
+
+		result = CompareResult();
+		result.width = w;
+		result.height = h;
+		result.channels = channels;
+		result.differing_pixels = total.differing;
+		double n = (double)w * h;
+		uint64_t sq = 0;
+		for (int c = 0; c < channels; c++)
+		{
+			result.max_error[c] = total.max[c];
+			result.mean_error[c] = total.abs[c] / n;
+			result.psnr[c] = psnr(total.sq[c] / n);
+			sq += total.sq[c];
+		}
+		result.psnr_total = psnr(sq / (n * channels));
+		result.ssim = total.differing ? ssim(da, sa, db, sb, w, h, channels) : 1.0;
+		return true;
+	}
+	catch (const char* msg)
+	{
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
+
+bool compare_files(const char *a, const char *b, CompareResult &result)
+{
+	MappedFile fa, fb;
+	if (!fa.open(a) || !fb.open(b))
+		return false;
+
+	Image ia;
+	ia.decode_bmp(fa.bytes(), fa.length());
+	if (!ia.buffer())
+		return false;
+
+	if (fa.length()==fb.length() && memcmp(fa.bytes(), fb.bytes(), fa.length())==0)
+	{
+		result = CompareResult();
+		result.width = ia.get_width();
+		result.height = ia.get_height();
+		result.channels = common_channels(ia, ia);
+		for (int c = 0; c < result.channels; c++)
+			result.psnr[c] = INFINITY;
+		result.psnr_total = INFINITY;
+		result.ssim = 1.0;
+		return true;
+	}
+
+	Image ib;
+	ib.decode_bmp(fb.bytes(), fb.length());
+	if (!ib.buffer())
+		return false;
+	return compare(ia, ib, result);
+}
+
+bool diff_map(const Image &a, const Image &b, Image &diff)
+{
+	if (!a.buffer() || !b.buffer() || a.get_width()!=b.get_width() || a.get_height()!=b.get_height())
+		return false;
+
+	Image ta, tb;
+	int channels = common_channels(a, b);
+	const Image *pa = with_channels(a, ta, channels);
+	const Image *pb = with_channels(b, tb, channels);
+	int w = a.get_width();
+	int h = a.get_height();
+	size_t sa = pa->get_stride();
+	size_t sb = pb->get_stride();
+	const uint8_t *da = pa->buffer();
+	const uint8_t *db = pb->buffer();
+
+	diff = Image(h, w, Image::GRAYSCALE);
+	uint8_t *out = diff.buffer();
+	parallel_bands(h, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const uint8_t *ra = da + y * sa;
+			const uint8_t *rb = db + y * sb;
+			uint8_t *ro = out + (size_t)y * w;
+			for (int x = 0; x < w; x++)
+			{
+				int m = 0;
+				for (int c = 0; c < channels; c++)
+					m = std::max(m, abs(ra[x * channels + c] - rb[x * channels + c]));
+				ro[x] = (uint8_t)m;
+			}
+		}
+	});
+	return true;
+}
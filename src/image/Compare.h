@@ -0,0 +1,36 @@
+#ifndef __COMPARE_H__
+#define __COMPARE_H__
+
+#include "Image.h"
+
+// Error statistics between two images of the same size, per channel in the
+// images' channel order. Indexed images are compared by colour, and an image
+// with fewer channels is widened to match the other (missing alpha is 255).
+struct CompareResult
+{
+	int width;
+	int height;
+	int channels;
+	int max_error[RGBAQUAD];			// Largest absolute difference
+	double mean_error[RGBAQUAD];		// Mean absolute difference
+	double psnr[RGBAQUAD];				// dB, infinite when the channel is identical
+	double psnr_total;						// dB over all channels
+	double ssim;									// Mean SSIM over 8x8 windows and all channels
+	uint64_t differing_pixels;		// Pixels with any channel different
+
+	CompareResult();
+
+	bool identical() const;
+};
+
+bool compare(const Image &a, const Image &b, CompareResult &result);
+
+// Compares two BMP files through read-only mappings. Byte-identical files
+// are recognised without computing any statistics beyond decoding one of
+// them for its size.
+bool compare_files(const char *a, const char *b, CompareResult &result);
+
+// Grayscale image of the largest absolute channel difference per pixel.
+bool diff_map(const Image &a, const Image &b, Image &diff);
+
+#endif //__COMPARE_H__
@@ -0,0 +1,185 @@
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "Composite.h"
+#include "Kernels.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+// Batches of fewer blits than this are blended on the calling thread.
+#define MASK_BATCH_PARALLEL 256
+
+static void load_row(const uint8_t *src, float *dst, int n)
+{
+	u8_to_f32_row(src, dst, n);
+}
+
+static void load_row(const uint16_t *src, float *dst, int n)
+{
+	u16_to_f32_row(src, dst, n);
+}
+
+static void load_row(const float *src, float *dst, int n)
+{
+	memcpy(dst, src, n * sizeof(float));
+}
+
+static void store_row(const float *src, uint8_t *dst, int n)
+{
+	f32_to_u8_row(src, dst, n);
+}
+
+static void store_row(const float *src, uint16_t *dst, int n)
+{
+	f32_to_u16_row(src, dst, n);
+}
+
+static void store_row(const float *src, float *dst, int n)
+{
+	memcpy(dst, src, n * sizeof(float));
+}
+
+// Expands n pixels of gray, gray + alpha, RGB or RGBA to RGBA.
+static void expand_rgba(const float *in, int channels, float *out, int n)
+{
+	for (int i = 0; i < n; i++, in += channels, out += 4)
+	{
+		bool gray = channels < 3;
+		out[0] = in[0];
+		out[1] = gray ? in[0] : in[1];
+		out[2] = gray ? in[0] : in[2];
+		out[3] = channels == 2 ? in[1] : (channels == 4 ? in[3] : 1.0f);
+	}
+}
+
+template <typename T>
+static void blend(T *dst, size_t ds, int dw, int dh, int dc, const T *src, size_t ss, int sw, int sh, int sc, int x, int y, float opacity)
+{
+	int x0 = std::max(x, 0);
+	int x1 = std::min(x + sw, dw);
+	int y0 = std::max(y, 0);
+	int y1 = std::min(y + sh, dh);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+	PROFILE_SCOPE(OP_COMPOSITE);
+	PROFILE_PIXELS((uint64_t)(x1 - x0) * (y1 - y0));
+
+	int n = x1 - x0;
+	parallel_bands(y1 - y0, [&](int begin, int end) {
+		std::vector<float> s((size_t)n * sc);
+		std::vector<float> rgba((size_t)n * 4);
+		std::vector<float> d((size_t)n * dc);
+		for (int j = begin; j < end; j++)
+		{
+			int dy = y0 + j;
+			const T *srow = src + (dy - y) * ss + (size_t)(x0 - x) * sc;
+			T *drow = dst + dy * ds + (size_t)x0 * dc;
+			load_row(srow, &s[0], n * sc);
+			expand_rgba(&s[0], sc, &rgba[0], n);
+			load_row(drow, &d[0], n * dc);
+			blend_over_row(&d[0], dc, &rgba[0], n, opacity);
+			store_row(&d[0], drow, n * dc);
+		}
+	});
+}
+
+bool composite_over(Image &dst, const Image &src, int x, int y, float opacity)
+{
+	if (!dst.buffer() || !src.buffer())
+		return false;
+	if (dst.get_bytespp()==1)
+	{
+		if (dst.is_view())
+			return false;
+		dst.to_rgb();
+	}
+
+	Image expanded;
+	const Image *s = &src;
+	if (src.get_bytespp()==1 && !src.is_grayscale())
+	{
+		expanded = src;
+		expanded.to_rgb();
+		s = &expanded;
+	}
+
+	blend(dst.buffer(), dst.get_stride(), dst.get_width(), dst.get_height(), dst.get_bytespp(),
+	      s->buffer(), s->get_stride(), s->get_width(), s->get_height(), s->get_bytespp(), x, y, opacity);
+	return true;
+}
+
+bool composite_masks(Image &dst, const Image &mask, const MaskBlit *blits, size_t count, const uint8_t *colour)
+{
+	if (!dst.buffer() || !mask.buffer() || mask.get_bytespp()!=1)
+		return false;
+	if (dst.get_bytespp()==1 && !dst.is_grayscale())
+	{
+		if (dst.is_view())
+			return false;
+		dst.to_rgb();
+	}
+	if (!count || !colour[3])
+		return true;
+	PROFILE_SCOPE(OP_COMPOSITE);
+
+	int dw = dst.get_width();
+	int dh = dst.get_height();
+	int dc = dst.get_bytespp();
+	size_t ds = dst.get_stride();
+	uint8_t *data = dst.buffer();
+	int mw = mask.get_width();
+	int mh = mask.get_height();
+	size_t ms = mask.get_stride();
+	const uint8_t *coverage = mask.buffer();
+
+	// Only the rows the blits touch are split between threads.
+	int top = dh, bottom = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		top = std::min(top, blits[i].dy);
+		bottom = std::max(bottom, blits[i].dy + blits[i].h);
+	}
+	top = std::max(top, 0);
+	bottom = std::min(bottom, dh);
+
+	auto band = [&](int begin, int end) {
+		for (size_t i = 0; i < count; i++)
+		{
+			const MaskBlit &b = blits[i];
+			// Clip the source rectangle to the mask, then the placement to
+			// this band of dst, moving the other side by the same amount.
+			int x0 = std::max(std::max(b.dx, b.dx - b.sx), 0);
+			int x1 = std::min(std::min(b.dx + b.w, b.dx - b.sx + mw), dw);
+			int y0 = std::max(std::max(b.dy, b.dy - b.sy), begin);
+			int y1 = std::min(std::min(b.dy + b.h, b.dy - b.sy + mh), end);
+			if (x0 >= x1)
+				continue;
+			for (int y = y0; y < y1; y++)
+			{
+				const uint8_t *src = coverage + (y - b.dy + b.sy) * ms + (x0 - b.dx + b.sx);
+				blend_coverage_row(data + y * ds + (size_t)x0 * dc, dc, src, x1 - x0, colour);
+			}
+		}
+	};
+	// Asking for the thread count alone costs more than a label's blits.
+	if (count < MASK_BATCH_PARALLEL)
+		band(top, bottom);
+	else
+		parallel_bands(bottom - top, [&](int begin, int end) { band(top + begin, top + end); });
+	return true;
+}
+
+template <typename T>
+bool composite_over(ImageT<T> &dst, const ImageT<T> &src, int x, int y, float opacity)
+{
+	if (!dst.buffer() || !src.buffer() || dst.get_channels() < 3 || src.get_channels() > 4)
+		return false;
+
+	blend(dst.buffer(), (size_t)dst.get_width() * dst.get_channels(), dst.get_width(), dst.get_height(), dst.get_channels(),
+	      src.buffer(), (size_t)src.get_width() * src.get_channels(), src.get_width(), src.get_height(), src.get_channels(), x, y, opacity);
+	return true;
+}
+
+template bool composite_over(ImageT<uint16_t> &, const ImageT<uint16_t> &, int, int, float);
+template bool composite_over(ImageT<float> &, const ImageT<float> &, int, int, float);
@@ -0,0 +1,36 @@
+#ifndef __COMPOSITE_H__
+#define __COMPOSITE_H__
+
+#include "Image.h"
+#include "ImageT.h"
+
+// Porter-Duff "source over destination" with straight (not premultiplied)
+// alpha. src is placed with its top left corner at (x, y) in dst and clipped
+// to dst; opacity scales the source alpha. Sources without alpha are opaque,
+// and gray sources are replicated to RGB.
+//
+// Blending is done in float for every format. An 8-bit dst that is indexed or
+// gray is expanded to RGB first; an Image16 or ImageF dst must be RGB or RGBA.
+bool composite_over(Image &dst, const Image &src, int x, int y, float opacity = 1.0f);
+
+template <typename T>
+bool composite_over(ImageT<T> &dst, const ImageT<T> &src, int x, int y, float opacity = 1.0f);
+
+// The w x h rectangle at (sx, sy) of a coverage mask, placed at (dx, dy).
+struct MaskBlit
+{
+	int sx, sy;
+	int w, h;
+	int dx, dy;
+};
+
+// Blends an RGBA colour (straight alpha) over dst through an 8-bit gray
+// coverage mask, once for each of count blits, in order. Blits are clipped
+// to both images. This is the fast path for many small sprites such as
+// glyphs: blending stays in 8-bit integers, uncovered pixels are skipped,
+// and one call covers a whole batch, split by rows of dst across threads.
+// A gray dst blends the colour's first component; an indexed one is
+// expanded to RGB first.
+bool composite_masks(Image &dst, const Image &mask, const MaskBlit *blits, size_t count, const uint8_t *colour);
+
+#endif //__COMPOSITE_H__
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+
+#include "Dispatch.h"
+#include "KernelVariants.h"
+
+static const char *LEVEL_NAMES[CPU_LEVELS] = {
+	"scalar",
+	"sse2",
+	"sse4.2",
+	"avx2",
+	"avx512",
+};
+
+CpuLevel cpu_detect()
+{
+#ifdef KERNELS_X86
+	// The builtins also check that the OS saves the wider registers.
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+		return CPU_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return CPU_AVX2;
+	if (__builtin_cpu_supports("sse4.2"))
+		return CPU_SSE42;
+	return CPU_SSE2;
+#else
+	return CPU_SCALAR;
+#endif
+}
+
+const char *cpu_level_name(CpuLevel level)
+{
+	if (level < 0 || level >= CPU_LEVELS)
+		return "unknown";
+	return LEVEL_NAMES[level];
+}
+
+bool parse_cpu_level(const char *name, CpuLevel &level)
+{
+	for (int i = 0; i < CPU_LEVELS; i++)
+	{
+		if (strcmp(name, LEVEL_NAMES[i]) == 0)
+		{
+			level = (CpuLevel)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+CpuLevel cpu_level()
+{
+	CpuLevel level = cpu_detect();
+	const char *forced = getenv("IMAGE_CPU_LEVEL");
+	if (!forced || !*forced)
+		return level;
+
+	CpuLevel wanted;
+	if (!parse_cpu_level(forced, wanted))
+		std::cerr << "Unknown IMAGE_CPU_LEVEL " << forced << std::endl;
+	else if (wanted > level)
+		std::cerr << "IMAGE_CPU_LEVEL " << forced << " is not supported by this CPU, using " << cpu_level_name(level) << std::endl;
+	else
+		level = wanted;
+	return level;
+}
+
+KernelTable kernel_table(CpuLevel level)
+{
+	KernelTable t;
+	t.level = CPU_SCALAR;
+	t.expand_palette_row = expand_palette_row_scalar;
+	t.swap_rb24_row = swap_rb24_row_scalar;
+	t.swap_rb32_row = swap_rb32_row_scalar;
+	t.fill_row = fill_row_scalar;
+	t.blend_over_row = blend_over_row_scalar;
+	t.downsample2x_row = downsample2x_row_scalar;
+
+#ifdef KERNELS_X86
+	if (level >= CPU_SSE2)
+	{
+		t.level = CPU_SSE2;
+		t.swap_rb32_row = swap_rb32_row_sse2;
+		t.fill_row = fill_row_sse2;
+		t.blend_over_row = blend_over_row_sse2;
+		t.downsample2x_row = downsample2x_row_sse2;
+	}
+	if (level >= CPU_SSE42)
+	{
+		t.level = CPU_SSE42;
+		t.expand_palette_row = expand_palette_row_sse42;
+		t.swap_rb24_row = swap_rb24_row_sse42;
+		t.swap_rb32_row = swap_rb32_row_sse42;
+	}
+	if (level >= CPU_AVX2)
+	{
+		t.level = CPU_AVX2;
+		t.expand_palette_row = expand_palette_row_avx2;
+		t.swap_rb32_row = swap_rb32_row_avx2;
+		t.fill_row = fill_row_avx2;
+		t.blend_over_row = blend_over_row_avx2;
+		t.downsample2x_row = downsample2x_row_avx2;
+	}
+	if (level >= CPU_AVX512)
+	{
+		t.level = CPU_AVX512;
+		t.expand_palette_row = expand_palette_row_avx512;
+		t.swap_rb32_row = swap_rb32_row_avx512;
+		t.fill_row = fill_row_avx512;
+		t.blend_over_row = blend_over_row_avx512;
+	}
+#endif
+	return t;
+}
+
+const KernelTable &kernels()
+{
+	static const KernelTable table = kernel_table(cpu_level());
+	return table;
+}
@@ -0,0 +1,49 @@
+#ifndef __DISPATCH_H__
+#define __DISPATCH_H__
+
+#include <stdint.h>
+
+// Runtime selection of the SIMD row kernels. The CPU is probed once, on the
+// first call to kernels(), and every kernel is bound to the best variant the
+// CPU supports, so a single binary runs on any x86-64 host. Set
+// IMAGE_CPU_LEVEL to scalar, sse2, sse4.2, avx2 or avx512 to force a lower
+// level, for example to check results against the scalar kernels.
+
+enum CpuLevel
+{
+	CPU_SCALAR,
+	CPU_SSE2,
+	CPU_SSE42,
+	CPU_AVX2,
+	CPU_AVX512,
+	CPU_LEVELS
+};
+
+struct KernelTable
+{
+	CpuLevel level;
+	void (*expand_palette_row)(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+	void (*swap_rb24_row)(const uint8_t *src, uint8_t *dst, int width);
+	void (*swap_rb32_row)(const uint8_t *src, uint8_t *dst, int width);
+	void (*fill_row)(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+	void (*blend_over_row)(float *dst, int channels, const float *src, int width, float opacity);
+	void (*downsample2x_row)(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels);
+};
+
+// Highest level the CPU and operating system support.
+CpuLevel cpu_detect();
+
+// Level the kernels are bound to: cpu_detect(), or IMAGE_CPU_LEVEL if that
+// is lower.
+CpuLevel cpu_level();
+
+const char *cpu_level_name(CpuLevel level);
+bool parse_cpu_level(const char *name, CpuLevel &level);
+
+// The best variant of each kernel at or below level. Levels the build has no
+// code for fall back to the next one down.
+KernelTable kernel_table(CpuLevel level);
+
+const KernelTable &kernels();
+
+#endif //__DISPATCH_H__
@@ -0,0 +1,448 @@
+#include <math.h>
+#include <string.h>
+#include <vector>
+
+#include "Filter.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+// Separable passes run over chunks of output rows so the horizontally
+// filtered rows of a chunk stay in cache, and the vertical pass walks each
+// chunk in column blocks so the kernel's rows of a block stay in L1.
+#define FILTER_CHUNK_ROWS   64
+#define FILTER_BLOCK_COLS   512
+
+static int border_index(int i, int n, BorderMode border)
+{
+	if (i >= 0 && i < n)
+		return i;
+
+	switch (border)
+	{
+	case BORDER_CLAMP:
+		return i < 0 ? 0 : n - 1;
+	case BORDER_MIRROR:
+	{
+		if (n == 1)
+			return 0;
+		int period = 2 * (n - 1);
+		i %= period;
+		if (i < 0)
+			i += period;
+		return i < n ? i : period - i;
+	}
+	case BORDER_WRAP:
+		i %= n;
+		return i < 0 ? i + n : i;
+	default:
+		return -1;
+	}
+}
+
+static bool prepare(Image &img)
+{
+	if (!img.buffer())
+		return false;
+	if (img.get_bytespp()==1 && !img.is_grayscale())
+	{
+		// Expanding the palette would detach a view from its parent.
+		if (img.is_view())
+			return false;
+		img.to_rgb();
+	}
+	return true;
+}
+
+// Converts a row to float with r pixels of border on each side. A NULL row
+// is a row outside the image under BORDER_ZERO.
+template <typename T>
+static void pad_row(const T *row, float *pad, int width, int channels, int r, BorderMode border)
+{
+	int line = width * channels;
+	if (!row)
+	{
+		memset(pad, 0, (line + 2 * r * channels) * sizeof(float));
+		return;
+	}
+
+	float *inner = pad + r * channels;
+	for (int i = 0; i < line; i++)
+		inner[i] = row[i];
+
+	for (int x = -r; x < 0; x++)
+	{
+		int sx = border_index(x, width, border);
+		for (int c = 0; c < channels; c++)
+			pad[(x + r) * channels + c] = sx < 0 ? 0.0f : row[sx * channels + c];
+	}
+	for (int x = width; x < width + r; x++)
+	{
+		int sx = border_index(x, width, border);
+		for (int c = 0; c < channels; c++)
+			pad[(x + r) * channels + c] = sx < 0 ? 0.0f : row[sx * channels + c];
+	}
+}
+
+static inline void accumulate(float *acc, const float *src, float k, int n)
+{
+	for (int i = 0; i < n; i++)
+		acc[i] += k * src[i];
+}
+
+static inline void store_row(const float *acc, uint8_t *dst, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float v = acc[i] + 0.5f;
+		dst[i] = v <= 0.0f ? 0 : (v >= 255.0f ? 255 : (uint8_t)v);
+	}
+}
+
+static inline void store_row(const float *acc, uint16_t *dst, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float v = acc[i] + 0.5f;
+		dst[i] = v <= 0.0f ? 0 : (v >= 65535.0f ? 65535 : (uint16_t)v);
+	}
+}
+
+static inline void store_row(const float *acc, float *dst, int n)
+{
+	memcpy(dst, acc, n * sizeof(float));
+}
+
+// Copies h rows of line samples, packed in src, to rows stride samples apart.
+template <typename T>
+static void unpack_rows(const T *src, T *dst, size_t stride, int line, int h)
+{
+	if (stride == (size_t)line)
+	{
+		memcpy(dst, src, (size_t)line * h * sizeof(T));
+		return;
+	}
+	for (int y = 0; y < h; y++)
+		memcpy(dst + y * stride, src + (size_t)y * line, line * sizeof(T));
+}
+
+template <typename T>
+static void separable_pass(T *data, size_t stride, int w, int h, int channels, const float *kx, int nx, const float *ky, int ny, BorderMode border)
+{
+	int line = w * channels;
+	int rx = nx / 2;
+	int ry = ny / 2;
+	const T *src = data;
+	std::vector<T> out((size_t)line * h);
+
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<float> pad((size_t)(w + 2 * rx) * channels);
+		std::vector<float> hbuf((size_t)(FILTER_CHUNK_ROWS + 2 * ry) * line);
+		std::vector<float> acc(FILTER_BLOCK_COLS);
+
+		for (int y0 = begin; y0 < end; y0 += FILTER_CHUNK_ROWS)
+		{
+			int y1 = std::min(end, y0 + FILTER_CHUNK_ROWS);
+			int rows = y1 - y0 + 2 * ry;
+			for (int j = 0; j < rows; j++)
+			{
+				int sy = border_index(y0 - ry + j, h, border);
+				pad_row(sy < 0 ? NULL : src + sy * stride, &pad[0], w, channels, rx, border);
+				float *hrow = &hbuf[(size_t)j * line];
+				memset(hrow, 0, line * sizeof(float));
+				for (int i = 0; i < nx; i++)
+					accumulate(hrow, &pad[i * channels], kx[i], line);
+			}
+
+			for (int b = 0; b < line; b += FILTER_BLOCK_COLS)
+			{
+				int bn = std::min(FILTER_BLOCK_COLS, line - b);
+				for (int y = y0; y < y1; y++)
+				{
+					memset(&acc[0], 0, bn * sizeof(float));
+					for (int j = 0; j < ny; j++)
+						accumulate(&acc[0], &hbuf[(size_t)(y - y0 + j) * line + b], ky[j], bn);
+					store_row(&acc[0], &out[(size_t)y * line + b], bn);
+				}
+			}
+		}
+	});
+
+	unpack_rows(&out[0], data, stride, line, h);
+}
+
+template <typename T>
+static void full_pass(T *data, size_t stride, int w, int h, int channels, const float *kernel, int kw, int kh, BorderMode border)
+{
+	int line = w * channels;
+	int rx = kw / 2;
+	int ry = kh / 2;
+	const T *src = data;
+	std::vector<T> out((size_t)line * h);
+
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<float> pad((size_t)(w + 2 * rx) * channels);
+		std::vector<float> acc(line);
+
+		for (int y = begin; y < end; y++)
+		{
+			memset(&acc[0], 0, line * sizeof(float));
+			for (int j = 0; j < kh; j++)
+			{
+				int sy = border_index(y - ry + j, h, border);
+				if (sy < 0)
+					continue;
+				pad_row(src + sy * stride, &pad[0], w, channels, rx, border);
+				for (int i = 0; i < kw; i++)
+				{
+					float k = kernel[j * kw + i];
+					if (k != 0.0f)
+						accumulate(&acc[0], &pad[i * channels], k, line);
+				}
+			}
+			store_row(&acc[0], &out[(size_t)y * line], line);
+		}
+	});
+
+	unpack_rows(&out[0], data, stride, line, h);
+}
+
+// Adds back amount times the difference between each sample and its blurred
+// counterpart, whose rows are packed.
+template <typename T>
+static void unsharp_pass(T *data, size_t stride, const T *soft, int h, int line, float amount)
+{
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<float> acc(line);
+		for (int y = begin; y < end; y++)
+		{
+			const T *o = data + y * stride;
+			const T *b = soft + (size_t)y * line;
+			for (int i = 0; i < line; i++)
+				acc[i] = o[i] + amount * ((float)o[i] - (float)b[i]);
+			store_row(&acc[0], data + y * stride, line);
+		}
+	});
+}
+
+static void gaussian_kernel(float sigma, std::vector<float> &k)
+{
+	int r = (int)ceil(3.0f * sigma);
+	k.resize(2 * r + 1);
+	float sum = 0.0f;
+	for (int i = -r; i <= r; i++)
+	{
+		k[i + r] = expf(-(float)(i * i) / (2.0f * sigma * sigma));
+		sum += k[i + r];
+	}
+	for (size_t i = 0; i < k.size(); i++)
+		k[i] /= sum;
+}
+
+bool convolve_separable(Image &img, const float *kx, int nx, const float *ky, int ny, BorderMode border)
+{
+	if (nx < 1 || ny < 1 || nx % 2 == 0 || ny % 2 == 0 || !prepare(img))
+		return false;
+	PROFILE_SCOPE(OP_FILTER);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+	separable_pass(img.buffer(), img.get_stride(), img.get_width(), img.get_height(), img.get_bytespp(), kx, nx, ky, ny, border);
+	return true;
+}
+
+bool convolve(Image &img, const float *kernel, int kw, int kh, BorderMode border)
+{
+	if (kw < 1 || kh < 1 || kw % 2 == 0 || kh % 2 == 0 || !prepare(img))
+		return false;
+	PROFILE_SCOPE(OP_FILTER);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+	full_pass(img.buffer(), img.get_stride(), img.get_width(), img.get_height(), img.get_bytespp(), kernel, kw, kh, border);
+	return true;
+}
+
+bool gaussian_blur(Image &img, float sigma, BorderMode border)
+{
+	if (sigma <= 0.0f)
+		return prepare(img);
+
+	std::vector<float> k;
+	gaussian_kernel(sigma, k);
+	return convolve_separable(img, &k[0], k.size(), &k[0], k.size(), border);
+}
+
+// Running sums make the cost independent of the radius: one add and one
+// subtract per channel per pass. Division by the window size is a fixed
+// point multiply.
+bool box_blur(Image &img, int radius, BorderMode border)
+{
+	if (radius <= 0)
+		return prepare(img);
+	if (!prepare(img))
+		return false;
+	PROFILE_SCOPE(OP_FILTER);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+
+	int w = img.get_width();
+	int h = img.get_height();
+	int channels = img.get_bytespp();
+	int line = w * channels;
+	int r = radius;
+	uint64_t mul = ((1ull << 24) + r) / (2 * r + 1);
+	uint8_t *data = img.buffer();
+	size_t stride = img.get_stride();
+	std::vector<uint8_t> tmp((size_t)line * h);
+
+	std::vector<int> xmap(w + 2 * r);
+	for (int t = -r; t < w + r; t++)
+		xmap[t + r] = border_index(t, w, border);
+
+	parallel_bands(h, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const uint8_t *row = data + y * stride;
+			uint8_t *dst = &tmp[(size_t)y * line];
+			for (int c = 0; c < channels; c++)
+			{
+				uint32_t sum = 0;
+				for (int t = -r; t <= r; t++)
+					if (xmap[t + r] >= 0)
+						sum += row[xmap[t + r] * channels + c];
+				for (int x = 0; x < w; x++)
+				{
+					dst[x * channels + c] = (uint8_t)((sum * mul + (1u << 23)) >> 24);
+					if (x + 1 < w)
+					{
+						int in = xmap[x + 1 + 2 * r];
+						int out = xmap[x];
+						if (in >= 0)
+							sum += row[in * channels + c];
+						if (out >= 0)
+							sum -= row[out * channels + c];
+					}
+				}
+			}
+		}
+	});
+
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<uint32_t> sums(line, 0);
+		for (int t = begin - r; t <= begin + r; t++)
+		{
+			int sy = border_index(t, h, border);
+			if (sy < 0)
+				continue;
+			const uint8_t *row = &tmp[(size_t)sy * line];
+			for (int i = 0; i < line; i++)
+				sums[i] += row[i];
+		}
+
+		for (int y = begin; y < end; y++)
+		{
+			uint8_t *dst = data + y * stride;
+			for (int i = 0; i < line; i++)
+				dst[i] = (uint8_t)((sums[i] * mul + (1u << 23)) >> 24);
+			if (y + 1 < end)
+			{
+				int in = border_index(y + 1 + r, h, border);
+				int out = border_index(y - r, h, border);
+				if (in >= 0)
+				{
+					const uint8_t *row = &tmp[(size_t)in * line];
+					for (int i = 0; i < line; i++)
+						sums[i] += row[i];
+				}
+				if (out >= 0)
+				{
+					const uint8_t *row = &tmp[(size_t)out * line];
+					for (int i = 0; i < line; i++)
+						sums[i] -= row[i];
+				}
+			}
+		}
+	});
+	return true;
+}
+
+// Unsharp mask: adds back amount times the difference between the image and
+// a Gaussian blurred copy of it.
+bool sharpen(Image &img, float amount, float sigma, BorderMode border)
+{
+	if (!prepare(img))
+		return false;
+	if (amount == 0.0f)
+		return true;
+
+	Image blurred(img);
+	if (!gaussian_blur(blurred, sigma, border))
+		return false;
+
+	unsharp_pass(img.buffer(), img.get_stride(), blurred.buffer(), img.get_height(), img.get_width() * img.get_bytespp(), amount);
+	return true;
+}
+
+template <typename T>
+bool convolve_separable(ImageT<T> &img, const float *kx, int nx, const float *ky, int ny, BorderMode border)
+{
+	if (nx < 1 || ny < 1 || nx % 2 == 0 || ny % 2 == 0 || !img.buffer())
+		return false;
+	PROFILE_SCOPE(OP_FILTER);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+	separable_pass(img.buffer(), (size_t)img.get_width() * img.get_channels(), img.get_width(), img.get_height(), img.get_channels(), kx, nx, ky, ny, border);
+	return true;
+}
+
+template <typename T>
+bool convolve(ImageT<T> &img, const float *kernel, int kw, int kh, BorderMode border)
+{
+	if (kw < 1 || kh < 1 || kw % 2 == 0 || kh % 2 == 0 || !img.buffer())
+		return false;
+	PROFILE_SCOPE(OP_FILTER);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+	full_pass(img.buffer(), (size_t)img.get_width() * img.get_channels(), img.get_width(), img.get_height(), img.get_channels(), kernel, kw, kh, border);
+	return true;
+}
+
+template <typename T>
+bool gaussian_blur(ImageT<T> &img, float sigma, BorderMode border)
+{
+	if (sigma <= 0.0f)
+		return img.buffer() != NULL;
+
+	std::vector<float> k;
+	gaussian_kernel(sigma, k);
+	return convolve_separable(img, &k[0], k.size(), &k[0], k.size(), border);
+}
+
+template <typename T>
+bool box_blur(ImageT<T> &img, int radius, BorderMode border)
+{
+	if (radius <= 0)
+		return img.buffer() != NULL;
+
+	std::vector<float> k(2 * radius + 1, 1.0f / (2 * radius + 1));
+	return convolve_separable(img, &k[0], k.size(), &k[0], k.size(), border);
+}
+
+template <typename T>
+bool sharpen(ImageT<T> &img, float amount, float sigma, BorderMode border)
+{
+	if (!img.buffer())
+		return false;
+	if (amount == 0.0f)
+		return true;
+
+	ImageT<T> blurred(img);
+	if (!gaussian_blur(blurred, sigma, border))
+		return false;
+
+	unsharp_pass(img.buffer(), (size_t)img.get_width() * img.get_channels(), blurred.buffer(), img.get_height(), img.get_width() * img.get_channels(), amount);
+	return true;
+}
+
+#define INSTANTIATE_FILTERS(T) \
+	template bool convolve(ImageT<T> &, const float *, int, int, BorderMode); \
+	template bool convolve_separable(ImageT<T> &, const float *, int, const float *, int, BorderMode); \
+	template bool gaussian_blur(ImageT<T> &, float, BorderMode); \
+	template bool box_blur(ImageT<T> &, int, BorderMode); \
+	template bool sharpen(ImageT<T> &, float, float, BorderMode);
+
+INSTANTIATE_FILTERS(uint16_t)
+INSTANTIATE_FILTERS(float)
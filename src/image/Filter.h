@@ -0,0 +1,42 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include "Image.h"
+#include "ImageT.h"
+
+// Filters work on every Image::Format in place. Channels are filtered
+// independently, alpha included. Indexed images with a non-grayscale palette
+// are expanded to RGB first, since filtering palette indices is meaningless.
+// Every filter accumulates in float; the 8 and 16-bit versions round once
+// when storing, and the float versions store unclamped results.
+
+enum BorderMode
+{
+	BORDER_CLAMP,		// Repeat the edge pixel
+	BORDER_MIRROR,	// Reflect about the edge pixel
+	BORDER_WRAP,		// Tile the image
+	BORDER_ZERO			// Treat pixels outside the image as 0
+};
+
+bool convolve(Image &img, const float *kernel, int kw, int kh, BorderMode border = BORDER_CLAMP);
+bool convolve_separable(Image &img, const float *kx, int nx, const float *ky, int ny, BorderMode border = BORDER_CLAMP);
+
+bool gaussian_blur(Image &img, float sigma, BorderMode border = BORDER_CLAMP);
+bool box_blur(Image &img, int radius, BorderMode border = BORDER_CLAMP);
+bool sharpen(Image &img, float amount, float sigma = 1.0f, BorderMode border = BORDER_CLAMP);
+
+// Image16 and ImageF versions of the above. box_blur runs as a separable
+// convolution here rather than with running sums, which would drift in float.
+template <typename T>
+bool convolve(ImageT<T> &img, const float *kernel, int kw, int kh, BorderMode border = BORDER_CLAMP);
+template <typename T>
+bool convolve_separable(ImageT<T> &img, const float *kx, int nx, const float *ky, int ny, BorderMode border = BORDER_CLAMP);
+
+template <typename T>
+bool gaussian_blur(ImageT<T> &img, float sigma, BorderMode border = BORDER_CLAMP);
+template <typename T>
+bool box_blur(ImageT<T> &img, int radius, BorderMode border = BORDER_CLAMP);
+template <typename T>
+bool sharpen(ImageT<T> &img, float amount, float sigma = 1.0f, BorderMode border = BORDER_CLAMP);
+
+#endif //__FILTER_H__
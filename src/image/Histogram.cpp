@@ -0,0 +1,214 @@
+#include <string.h>
+#include <mutex>
+
+#include "Histogram.h"
+#include "Lut.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+Histogram::Histogram() : channels(0), count(0)
+{
+	clear();
+}
+
+void Histogram::clear()
+{
+	count = 0;
+	memset(bins, 0, sizeof(bins));
+}
+
+void Histogram::merge(const Histogram &h)
+{
+	if (h.channels > channels)
+		channels = h.channels;
+	count += h.count;
+	for (int c = 0; c < h.channels; c++)
+		for (int v = 0; v < NUM_COLORS; v++)
+			bins[c][v] += h.bins[c][v];
+}
+
+uint8_t Histogram::min(int c)
+{
+	for (int v = 0; v < NUM_COLORS; v++)
+		if (bins[c][v])
+			return v;
+	return 0;
+}
+
+uint8_t Histogram::max(int c)
+{
+	for (int v = NUM_COLORS - 1; v >= 0; v--)
+		if (bins[c][v])
+			return v;
+	return 0;
+}
+
+double Histogram::mean(int c)
+{
+	if (count == 0)
+		return 0.0;
+	double sum = 0.0;
+	for (int v = 0; v < NUM_COLORS; v++)
+		sum += (double)v * bins[c][v];
+	return sum / count;
+}
+
+uint8_t Histogram::percentile(int c, double p)
+{
+	if (p <= 0.0)
+		return min(c);
+	double target = p * count;
+	uint64_t cumulative = 0;
+	for (int v = 0; v < NUM_COLORS; v++)
+	{
+		cumulative += bins[c][v];
+		if (cumulative > 0 && cumulative >= target)
+			return v;
+	}
+	return max(c);
+}
+
+static void count_rows(const uint8_t *data, size_t stride, int width, int channels, int begin, int end, Histogram &h)
+{
+	if (channels == 1)
+	{
+		// Four interleaved tables keep runs of equal pixels, the common case in
+		// masks, from serialising on a single counter.
+		uint32_t t[4][NUM_COLORS];
+		memset(t, 0, sizeof(t));
+		for (int y = begin; y < end; y++)
+		{
+			const uint8_t *row = data + y * stride;
+			int x = 0;
+			for (; x + 4 <= width; x += 4)
+			{
+				t[0][row[x]]++;
+				t[1][row[x + 1]]++;
+				t[2][row[x + 2]]++;
+				t[3][row[x + 3]]++;
+			}
+			for (; x < width; x++)
+				t[0][row[x]]++;
+		}
+		for (int v = 0; v < NUM_COLORS; v++)
+			h.bins[0][v] += (uint64_t)t[0][v] + t[1][v] + t[2][v] + t[3][v];
+		return;
+	}
+
+	for (int y = begin; y < end; y++)
+	{
+		const uint8_t *row = data + y * stride;
+		for (int x = 0; x < width; x++, row += channels)
+			for (int c = 0; c < channels; c++)
+				h.bins[c][row[c]]++;
+	}
+}
+
+Histogram histogram(const Image &img)
+{
+	Histogram result;
+	if (!img.buffer())
+		return result;
+	PROFILE_SCOPE(OP_HISTOGRAM);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+
+	int w = img.get_width();
+	int channels = img.get_bytespp();
+	const uint8_t *data = img.buffer();
+	size_t stride = img.get_stride();
+	result.channels = channels;
+
+	std::mutex lock;
+	parallel_bands(img.get_height(), [&](int begin, int end) {
+		Histogram local;
+		local.channels = channels;
+		local.count = (uint64_t)(end - begin) * w;
+		count_rows(data, stride, w, channels, begin, end, local);
+
+		std::lock_guard<std::mutex> guard(lock);
+		result.merge(local);
+	});
+
+	if (channels == 1 && !img.is_grayscale())
+	{
+		const uint8_t *pal = img.palette_buffer();
+		Histogram rgb;
+		rgb.channels = Image::RGB;
+		rgb.count = result.count;
+		for (int i = 0; i < img.get_palette_size() / RGBAQUAD; i++)
+		{
+			const uint8_t *entry = pal + i * RGBAQUAD;
+			rgb.bins[0][entry[2]] += result.bins[0][i];
+			rgb.bins[1][entry[1]] += result.bins[0][i];
+			rgb.bins[2][entry[0]] += result.bins[0][i];
+		}
+		return rgb;
+	}
+	return result;
+}
+
+static int colour_channels(const Histogram &hist)
+{
+	return hist.channels == RGBAQUAD ? Image::RGB : hist.channels;
+}
+
+// A grayscale histogram drives all three colour channels of the table.
+static int channel_mask(const Histogram &hist, int c)
+{
+	return hist.channels == 1 ? CHANNELS_RGB : (1 << c);
+}
+
+bool auto_levels(Image &img, double low, double high)
+{
+	Histogram hist = histogram(img);
+	if (hist.count == 0)
+		return false;
+
+	ColourLut lut;
+	for (int c = 0; c < colour_channels(hist); c++)
+	{
+		int lo = hist.percentile(c, low);
+		int hi = hist.percentile(c, high);
+		uint8_t stretch[NUM_COLORS];
+		for (int v = 0; v < NUM_COLORS; v++)
+		{
+			int out = v;
+			if (hi > lo)
+			{
+				out = ((v - lo) * 255 + (hi - lo) / 2) / (hi - lo);
+				out = out < 0 ? 0 : (out > 255 ? 255 : out);
+			}
+			stretch[v] = out;
+		}
+		lut.map(stretch, channel_mask(hist, c));
+	}
+	return lut.apply(img);
+}
+
+bool equalize(Image &img)
+{
+	Histogram hist = histogram(img);
+	if (hist.count == 0)
+		return false;
+
+	ColourLut lut;
+	for (int c = 0; c < colour_channels(hist); c++)
+	{
+		uint8_t cdf_map[NUM_COLORS];
+		uint64_t cdf = 0;
+		uint64_t cdf_min = 0;
+		for (int v = 0; v < NUM_COLORS; v++)
+		{
+			cdf += hist.bins[c][v];
+			if (cdf_min == 0)
+				cdf_min = cdf;
+
+			int out = v;
+			if (hist.count > cdf_min)
+				out = (int)(((cdf - cdf_min) * 255.0) / (hist.count - cdf_min) + 0.5);
+			cdf_map[v] = out;
+		}
+		lut.map(cdf_map, channel_mask(hist, c));
+	}
+	return lut.apply(img);
+}
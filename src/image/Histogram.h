@@ -0,0 +1,34 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include "Image.h"
+
+// Per-channel histogram of an image. Indexed images with a non-grayscale
+// palette are counted by the colours their indices refer to, as RGB.
+struct Histogram
+{
+	int channels;
+	uint64_t count;
+	uint64_t bins[RGBAQUAD][NUM_COLORS];
+
+	Histogram();
+
+	void clear();
+	void merge(const Histogram &h);
+
+	uint8_t min(int c);
+	uint8_t max(int c);
+	double mean(int c);
+	uint8_t percentile(int c, double p);
+};
+
+Histogram histogram(const Image &img);
+
+// Stretches each colour channel so that the given low and high percentiles
+// map to 0 and 255. Alpha is left untouched.
+bool auto_levels(Image &img, double low = 0.005, double high = 0.995);
+
+// Per-channel histogram equalization. Alpha is left untouched.
+bool equalize(Image &img);
+
+#endif //__HISTOGRAM_H__
@@ -4,8 +4,14 @@
 #include <time.h>
 #include <math.h>
 #include <stdio.h>
+#include <sys/stat.h>
+#include <vector>
 
 #include "Image.h"
+#include "ImageCache.h"
+#include "Kernels.h"
+#include "Profile.h"
+#include "Quantize.h"
 
 using namespace Eigen;
 
@@ -18,14 +24,14 @@ struct ImageOutOfBoundsException : public std::exception
 };
 
 
-Image::Image() : data(NULL), width(0), height(0), bytespp(0), palette(0)
+Image::Image() : pixels(NULL), borrowed(false), data(NULL), width(0), height(0), bytespp(0), stride(0), palette(0)
 {
 }
 
-Image::Image(int h, int w, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), palette(0)
+Image::Image(int h, int w, int bpp) : pixels(NULL), borrowed(false), data(NULL), width(w), height(h), bytespp(bpp), stride(w * bpp), palette(0)
 {
-	uint64_t nbytes = width * height * bytespp;
-	data = new uint8_t[nbytes];
+	uint64_t nbytes = (uint64_t)width * height * bytespp;
+	adopt(new uint8_t[nbytes]);
 	memset(data, 0, nbytes);
 	if (bpp == 1)
 	{
@@ -34,25 +40,144 @@ Image::Image(int h, int w, int bpp) : data(NULL), width(w), height(h), bytespp(b
 	
 }
 
-Image::Image(const Image &img)
+Image::Image(const Image &img) : pixels(NULL), borrowed(false), data(NULL)
 {
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
-	uint64_t nbytes = width * height * bytespp;
-	data = new uint8_t[nbytes];
-	memcpy(data, img.data, nbytes);
-	palette = img.palette;
+	stride = width * bytespp;
+	if (img.shareable())
+	{
+		pixels = img.pixels;
+		data = img.data;
+		if (pixels)
+			pixels->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		adopt(img.packed_copy());
+	}
+	copy_palette(img.palette);
+}
+
+Image::Image(Image &parent, int x, int y, int w, int h) : pixels(NULL), borrowed(false), data(NULL), width(0), height(0), bytespp(0), stride(0), palette(0)
+{
+	try
+	{
+		if (!parent.data)
+			throw "Nothing to view";
+		if (w <= 0 || h <= 0 || x < 0 || y < 0 || x + w > parent.width || y + h > parent.height)
+			throw "Region exceeds bounds of image.";
+
+		// Copies of an image with views own their pixels, so only the first
+		// view needs the parent to detach. Skipping it afterwards also keeps
+		// the parent's pixels in place while other views are made.
+		if (parent.pixels->views.load(std::memory_order_acquire) == 0)
+			parent.detach();
+		pixels = parent.pixels;
+		pixels->refs.fetch_add(1, std::memory_order_relaxed);
+		pixels->views.fetch_add(1, std::memory_order_relaxed);
+		borrowed = true;
+		data = parent.data + (size_t)y * parent.stride + (size_t)x * parent.bytespp;
+		width = w;
+		height = h;
+		bytespp = parent.bytespp;
+		stride = parent.stride;
+		copy_palette(parent.palette);
+	}
+	catch (const char* msg)
+	{
+		std::cerr << msg << std::endl;
+	}
 }
 
 Image::~Image()
 {
-	if (data)
-		delete[] data;
-	
+	release_pixels();
+	release_palette();
+}
+
+void Image::release_pixels()
+{
+	if (borrowed)
+		pixels->views.fetch_sub(1, std::memory_order_relaxed);
+	if (pixels && pixels->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		delete[] pixels->bytes;
+		delete pixels;
+	}
+	pixels = NULL;
+	borrowed = false;
+	data = NULL;
+}
+
+// Takes ownership of a buffer from new[], dropping this image's share of the
+// previous one.
+void Image::adopt(uint8_t *bytes)
+{
+	release_pixels();
+	pixels = new PixelBuffer;
+	pixels->refs.store(1, std::memory_order_relaxed);
+	pixels->views.store(0, std::memory_order_relaxed);
+	pixels->bytes = bytes;
+	data = bytes;
+}
+
+// Whether another image owns the pixels too. Views hold shares as well, but
+// writes are meant to reach them.
+bool Image::shared() const
+{
+	int views = pixels->views.load(std::memory_order_acquire);
+	return pixels->refs.load(std::memory_order_acquire) - views != 1;
+}
+
+// Gives this image its own copy of the pixels if any other image shares them.
+void Image::detach()
+{
+	if (!pixels || borrowed || !shared())
+		return;
+	adopt(packed_copy());
+}
+
+bool Image::shareable() const
+{
+	return !borrowed && (!pixels || pixels->views.load(std::memory_order_relaxed) == 0);
+}
+
+// The pixels with rows packed back to back, in a buffer from new[].
+uint8_t *Image::packed_copy() const
+{
+	if (!data)
+		return NULL;
+	size_t line = (size_t)width * bytespp;
+	uint8_t *copy = new uint8_t[line * height];
+	if ((size_t)stride == line)
+		memcpy(copy, data, line * height);
+	else
+		for (int y = 0; y < height; y++)
+			memcpy(copy + y * line, data + (size_t)y * stride, line);
+	return copy;
+}
+
+void Image::release_palette()
+{
 	if (palette.size>0)
 		delete[] palette.data;
-		
+	palette.size = 0;
+	palette.data = NULL;
+}
+
+void Image::copy_palette(const Palette &p)
+{
+	if (palette.size!=p.size)
+	{
+		release_palette();
+		if (p.size>0)
+			palette.data = new uint8_t[p.size];
+		palette.size = p.size;
+	}
+	if (p.size>0)
+		memcpy(palette.data, p.data, p.size);
 }
 
 
@@ -60,14 +185,23 @@ Image &Image::operator=(const Image &img)
 {
 	if (this != &img)
 	{
-		if (data)
-			delete[] data;
+		if (img.shareable())
+		{
+			if (img.pixels)
+				img.pixels->refs.fetch_add(1, std::memory_order_relaxed);
+			release_pixels();
+			pixels = img.pixels;
+			data = img.data;
+		}
+		else
+		{
+			adopt(img.packed_copy());
+		}
 		width = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
-		unsigned long nbytes = width * height * bytespp;
-		data = new uint8_t[nbytes];
-		memcpy(data, img.data, nbytes);
+		stride = width * bytespp;
+		copy_palette(img.palette);
 	}
 	return *this;
 }
@@ -77,9 +211,10 @@ void Image::printData()
 	size_t i = 0;
 	for (size_t y = 0; y < height; y++)
 	{
+		const uint8_t *row = data + y * stride;
 		for (size_t x = 0; x < width; x++)
 		{			
-			printf("%zu: (%zu, %zu) [%d, %d, %d]\n", i, y, x, data[i], data[i+1], data[i+2]);
+			printf("%zu: (%zu, %zu) [%d, %d, %d]\n", i, y, x, row[x*3], row[x*3+1], row[x*3+2]);
 			i+=3;
 		}
 	}
@@ -87,65 +222,419 @@ void Image::printData()
 
 void Image::write_bmp(const char *filename, bool improvise_palette)
 {
+	PROFILE_SCOPE(OP_WRITE_BMP);
+	if (improvise_palette && bytespp > 1)
+	{
+		Image indexed(*this);
+		if (quantize(indexed))
+		{
+			indexed.write_bmp(filename);
+			return;
+		}
+	}
+
 	try
 	{
+		std::vector<uint8_t> bytes;
+		encode_bmp(bytes);
+
 		FILE* fp;
-		fp = fopen(filename, "w");
+		fp = fopen(filename, "wb");
 		if (fp == NULL)
 		{
 			throw "Could not open file";
 		}
-		
-		size_t multipleOf4Check = width * bytespp % 4;
-		size_t paddingCnt = (multipleOf4Check)==0 ? 0 : 4 - multipleOf4Check;
-		uint8_t padding[4] = {0x00, 0x00, 0x00, 0x00};
+		if (fwrite(&bytes[0], bytes.size(), 1, fp)!=1)
+		{
+			fclose(fp);
+			throw "Could not write data to file";
+		}
+		fclose(fp);
+		PROFILE_PIXELS((uint64_t)width * height);
+		PROFILE_BYTES_WRITTEN(bytes.size());
+	}
+	catch (const char* msg) 
+	{
+    std::cerr << msg << std::endl;
+  }
+}
 
-		size_t fileSize;
-		BMPHeader header;
-		// int table_size = 0;
-		uint32_t image_size = (width * bytespp + paddingCnt) * height;
+void Image::encode_bmp(std::vector<uint8_t> &bytes) const
+{
+	size_t multipleOf4Check = width * bytespp % 4;
+	size_t paddingCnt = (multipleOf4Check)==0 ? 0 : 4 - multipleOf4Check;
+
+	size_t fileSize;
+	BMPHeader header;
+	uint32_t image_size = (width * bytespp + paddingCnt) * height;
+	// RGBA needs a V4 header to carry its alpha mask; BI_RGB has none.
+	size_t header_size = bytespp == RGBA ? BMP_FILEH_SIZE + BMP_V4_SIZE : BMP_HEADER_SIZE;
 
-		if (bytespp > 1)
+	if (bytespp > 1)
+	{
+		fileSize = ((width * bytespp) + paddingCnt) * height + header_size;
+		header = BMPHeader(width, height, bytespp, fileSize, image_size);
+		header.fileHeader.data_offset = header_size;
+	}
+	else 
+	{
+		fileSize = ((width * bytespp) + paddingCnt) * height + BMP_HEADER_SIZE + palette.size;
+		header = BMPHeader(width, height, bytespp, fileSize, image_size);
+		header.fileHeader.data_offset += palette.size;
+	}
+
+	bytes.assign(header_size + palette.size + image_size, 0x00);
+	uint8_t *out = &bytes[0];
+	if (bytespp == RGBA)
+	{
+		header.infoHeader.info_header_size = BMP_V4_SIZE;
+		header.infoHeader.compression = BI_BITFIELDS;
+		const uint32_t v4[5] = {0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000, LCS_SRGB};
+		memcpy(out + BMP_HEADER_SIZE, v4, sizeof(v4));
+	}
+	memcpy(out, &header.fileHeader, BMP_FILEH_SIZE);
+	memcpy(out + BMP_FILEH_SIZE, &header.infoHeader, BMP_INFH_SIZE);
+	out += header_size;
+	if (palette.size>0)
+	{
+		memcpy(out, palette.data, palette.size);
+		out += palette.size;
+	}
+
+	size_t scanline_len = width * bytespp;
+	for (int i = height - 1; i >= 0; i--, out += scanline_len + paddingCnt)
+	{
+		const uint8_t *row = data + (size_t)i * stride;
+		switch (bytespp)
+		{
+		case 1:
+			memcpy(out, row, scanline_len);
+			break;
+		case 3:
+			pack_bgr24_row(row, out, width);
+			break;
+		case 4:
+			pack_bgra32_row(row, out, width);
+			break;
+		default:
+			for (size_t j = 0; j < scanline_len; j += bytespp)
+				for (int k = 0; k < bytespp; k++)
+					out[j + k] = row[j + bytespp - 1 - k];
+		}
+	}
+}
+
+enum BMPPixelFormat
+{
+	PAL1,
+	PAL4,
+	PAL8,
+	BGR24,
+	BGRA32,
+	BGRX32,
+	RGB565,
+	RGB555,
+	BITFIELDS16,
+	BITFIELDS32
+};
+
+// Fills in the file and info headers and the channel masks. V4 and V5 headers
+// are read as their leading 40 bytes; the masks live at the same offset in
+// every header version, or straight after a 40 byte header for BI_BITFIELDS.
+static void parse_bmp_header(const uint8_t *bytes, size_t len, BMPHeader &header)
+{
+	if (len < BMP_FILEH_SIZE + BMP_INFH_SIZE)
+		throw "Could not read data from file";
+
+	memcpy(&header.fileHeader, bytes, BMP_FILEH_SIZE);
+	memcpy(&header.infoHeader, bytes + BMP_FILEH_SIZE, BMP_INFH_SIZE);
+
+	if (header.fileHeader.signature != MAGIC_VALUE)
+		throw "Not a BMP file";
+
+	uint32_t info_size = header.infoHeader.info_header_size;
+	uint32_t compression = header.infoHeader.compression;
+	if (info_size < BMP_INFH_SIZE)
+		throw "Unsupported BMP header";
+
+	if (compression == BI_BITFIELDS || compression == BI_ALPHABITFIELDS)
+	{
+		size_t nmasks = 3;
+		if (compression == BI_ALPHABITFIELDS || info_size >= BMP_INFH_SIZE + 4 * RGBAQUAD)
+			nmasks = 4;
+		if (len < BMP_HEADER_SIZE + nmasks * 4)
+			throw "Could not read data from file";
+
+		uint32_t m[4] = {0, 0, 0, 0};
+		memcpy(m, bytes + BMP_HEADER_SIZE, nmasks * 4);
+		header.masks.red = m[0];
+		header.masks.green = m[1];
+		header.masks.blue = m[2];
+		header.masks.alpha = m[3];
+	}
+	else if (compression == BI_RGB)
+	{
+		if (header.infoHeader.bits_per_pixel == 16)
 		{
-			fileSize = ((width * bytespp) + paddingCnt) * height + BMP_HEADER_SIZE;
-			header = BMPHeader(width, height, bytespp, fileSize, image_size);
+			header.masks.red = 0x7C00;
+			header.masks.green = 0x03E0;
+			header.masks.blue = 0x001F;
 		}
-		else 
+		else if (header.infoHeader.bits_per_pixel == 32)
 		{
-			fileSize = ((width * bytespp) + paddingCnt) * height + BMP_HEADER_SIZE + palette.size;
-			header = BMPHeader(width, height, bytespp, fileSize, palette.size,image_size);
-			
+			// The fourth byte of BI_RGB pixels is padding, often zero, so
+			// alpha is only read when a mask says it is there.
+			header.masks.red = 0x00FF0000;
+			header.masks.green = 0x0000FF00;
+			header.masks.blue = 0x000000FF;
 		}
+	}
+	else
+	{
+		throw "Unsupported BMP compression";
+	}
+}
 
-		if (fwrite(&header.fileHeader, BMP_FILEH_SIZE, 1, fp)!=1)
-			throw "Could not write data to file";
+static BMPPixelFormat bmp_pixel_format(const BMPHeader &header)
+{
+	const BMPHeader::BitMasks &m = header.masks;
+	bool bitfields = header.infoHeader.compression != BI_RGB;
 
-		if (fwrite(&header.infoHeader, BMP_INFH_SIZE, 1, fp)!=1)
-			throw "Could not write data to file";
+	switch (header.infoHeader.bits_per_pixel)
+	{
+	case 1:
+		if (!bitfields)
+			return PAL1;
+		break;
+	case 4:
+		if (!bitfields)
+			return PAL4;
+		break;
+	case 8:
+		if (!bitfields)
+			return PAL8;
+		break;
+	case 24:
+		if (!bitfields)
+			return BGR24;
+		break;
+	case 16:
+		if (m.red == 0xF800 && m.green == 0x07E0 && m.blue == 0x001F && m.alpha == 0)
+			return RGB565;
+		if (m.red == 0x7C00 && m.green == 0x03E0 && m.blue == 0x001F && m.alpha == 0)
+			return RGB555;
+		return BITFIELDS16;
+	case 32:
+		if (m.red == 0x00FF0000 && m.green == 0x0000FF00 && m.blue == 0x000000FF)
+		{
+			if (m.alpha == 0xFF000000)
+				return BGRA32;
+			if (m.alpha == 0)
+				return BGRX32;
+		}
+		return BITFIELDS32;
+	}
+	throw "Unsupported BMP pixel format";
+}
+
+static int bmp_channels(BMPPixelFormat format, const BMPHeader &header)
+{
+	switch (format)
+	{
+	case PAL1:
+	case PAL4:
+	case PAL8:
+		return Image::GRAYSCALE;
+	case BGRA32:
+		return Image::RGBA;
+	case BITFIELDS16:
+	case BITFIELDS32:
+		return header.masks.alpha ? Image::RGBA : Image::RGB;
+	default:
+		return Image::RGB;
+	}
+}
+
+static uint32_t bmp_palette_offset(const BMPHeader &header)
+{
+	uint32_t offset = BMP_FILEH_SIZE + header.infoHeader.info_header_size;
+	if (header.infoHeader.info_header_size == BMP_INFH_SIZE)
+	{
+		if (header.infoHeader.compression == BI_BITFIELDS)
+			offset += 3 * 4;
+		else if (header.infoHeader.compression == BI_ALPHABITFIELDS)
+			offset += 4 * 4;
+	}
+	return offset;
+}
+
+// Number of palette entries actually present between the headers and the
+// pixel data; files that claim more entries than fit get the ones that do.
+static uint32_t bmp_palette_count(const BMPHeader &header, size_t len)
+{
+	uint32_t pal_offset = bmp_palette_offset(header);
+	uint32_t data_offset = header.fileHeader.data_offset;
+	uint32_t count = 1u << header.infoHeader.bits_per_pixel;
+	if (header.infoHeader.num_colors > 0 && header.infoHeader.num_colors < count)
+		count = header.infoHeader.num_colors;
+
+	uint32_t pal_end = data_offset < len ? data_offset : len;
+	if (pal_offset >= pal_end)
+		return 0;
+	if ((pal_end - pal_offset) / RGBAQUAD < count)
+		count = (pal_end - pal_offset) / RGBAQUAD;
+	return count;
+}
+
+static size_t bmp_row_bytes(int width, int bits_per_pixel)
+{
+	return (((size_t)width * bits_per_pixel + 31) / 32) * 4;
+}
+
+// Everything the decoders need from a header, checked against the length of
+// the whole file so that the row loops can run without any checks.
+struct BMPLayout
+{
+	BMPPixelFormat format;
+	int width;
+	int height;
+	bool top_down;
+	int bits;
+	int channels;
+	size_t row_bytes;
+	uint32_t data_offset;
+	uint32_t palette_offset;
+	uint32_t palette_count;
+};
+
+// A channel mask must be one run of set bits for BitFields to scale it.
+static bool bmp_mask_contiguous(uint32_t mask)
+{
+	if (mask == 0)
+		return true;
+	while (!(mask & 1))
+		mask >>= 1;
+	return (mask & (mask + 1)) == 0;
+}
+
+static void check_bmp(const BMPHeader &header, size_t len, BMPLayout &layout)
+{
+	const BMPHeader::InfoHeader &info = header.infoHeader;
+	layout.format = bmp_pixel_format(header);
+	layout.bits = info.bits_per_pixel;
+	layout.channels = bmp_channels(layout.format, header);
+	const BMPHeader::BitMasks &m = header.masks;
+	if (!bmp_mask_contiguous(m.red) || !bmp_mask_contiguous(m.green) ||
+	    !bmp_mask_contiguous(m.blue) || !bmp_mask_contiguous(m.alpha))
+		throw "Unsupported BMP bit masks";
+
+	// INT32_MIN has no positive counterpart.
+	if (info.width_px <= 0 || info.height_px == 0 || info.height_px == INT32_MIN)
+		throw "Invalid BMP dimensions";
+	layout.width = info.width_px;
+	layout.top_down = info.height_px < 0;
+	layout.height = layout.top_down ? -info.height_px : info.height_px;
+	if ((uint64_t)layout.width * layout.channels > INT32_MAX)
+		throw "BMP too large";
+
+	// The headers and masks come before the pixels, and every row is in the
+	// file. Checked in 64 bits so that no field can wrap the sums.
+	layout.data_offset = header.fileHeader.data_offset;
+	uint64_t headers_end = (uint64_t)BMP_FILEH_SIZE + info.info_header_size;
+	if (info.info_header_size == BMP_INFH_SIZE && info.compression == BI_BITFIELDS)
+		headers_end += 3 * 4;
+	else if (info.info_header_size == BMP_INFH_SIZE && info.compression == BI_ALPHABITFIELDS)
+		headers_end += 4 * 4;
+	if (headers_end > layout.data_offset || layout.data_offset > len)
+		throw "Invalid BMP data offset";
+	layout.row_bytes = bmp_row_bytes(layout.width, layout.bits);
+	if ((len - layout.data_offset) / layout.row_bytes < (size_t)layout.height)
+		throw "Could not read data from file";
+
+	layout.palette_offset = bmp_palette_offset(header);
+	layout.palette_count = layout.bits <= 8 ? bmp_palette_count(header, len) : 0;
+}
 
-		if (palette.size>0)
-			if (fwrite(palette.data, palette.size, 1, fp)!=1)
-				throw "Could not write data to file";
+static void unpack_bmp_row(BMPPixelFormat format, const uint8_t *src, uint8_t *dst, int width, const BitFields &bf, int channels)
+{
+	switch (format)
+	{
+	case PAL1:
+		unpack_pal1_row(src, dst, width);
+		break;
+	case PAL4:
+		unpack_pal4_row(src, dst, width);
+		break;
+	case PAL8:
+		unpack_pal8_row(src, dst, width);
+		break;
+	case BGR24:
+		unpack_bgr24_row(src, dst, width);
+		break;
+	case BGRA32:
+		unpack_bgra32_row(src, dst, width);
+		break;
+	case BGRX32:
+		unpack_bgrx32_row(src, dst, width);
+		break;
+	case RGB565:
+		unpack_rgb565_row(src, dst, width);
+		break;
+	case RGB555:
+		unpack_rgb555_row(src, dst, width);
+		break;
+	case BITFIELDS16:
+		unpack_bitfields16_row(src, dst, width, bf, channels);
+		break;
+	case BITFIELDS32:
+		unpack_bitfields32_row(src, dst, width, bf, channels);
+		break;
+	}
+}
 
+void Image::read_bmp(const char *filename)
+{
+	// The cache profiles its own reads.
+	ImageCache &cache = ImageCache::shared();
+	if (cache.enabled())
+	{
+		std::shared_ptr<const Image> image = cache.read_bmp(filename);
+		if (image)
+			*this = *image;
+		return;
+	}
+
+	PROFILE_SCOPE(OP_READ_BMP);
+	try
+	{
+		FILE* fp = fopen(filename, "rb");
+		if (fp==NULL)
+			throw "Could not open file";
 
-		for (int i = height - 1; i >= 0; i--)
+		// ftell is meaningless for directories and devices.
+		struct stat st;
+		if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode))
+		{
+			fclose(fp);
+			throw "Not a regular file";
+		}
+		std::vector<uint8_t> bytes;
+		size_t len = st.st_size;
+		if (len > 0)
 		{
-			int y_pos = i*width*bytespp;
-			for (size_t j = 0; j < width; j++)
+			bytes.resize(len);
+			if (fread(&bytes[0], len, 1, fp)!=1)
 			{
-				int x_pos = j*bytespp;
-				for (int k = bytespp - 1; k >= 0; k--)
-				{
-					// printf("w: [%d] (%d, %zu, %d) %d\n", y_pos + x_pos + k, i, j, k, data[y_pos + x_pos + k]);
-					if (fwrite(&data[y_pos + x_pos + k], sizeof(uint8_t), 1, fp)<0)
-						throw "Could not write data to file";
-				}
-				
+				fclose(fp);
+				throw "Could not read data from file";
 			}
-			if (fwrite(&padding, paddingCnt, 1, fp)<0)
-				throw "Could not write data to file";
 		}
 		fclose(fp);
+		PROFILE_BYTES_READ(bytes.size());
+
+		if (bytes.empty())
+			throw "Could not read data from file";
+		decode_bmp(&bytes[0], bytes.size());
 	}
 	catch (const char* msg) 
 	{
@@ -153,77 +642,185 @@ void Image::write_bmp(const char *filename, bool improvise_palette)
   }
 }
 
-void Image::read_bmp(const char *filename)
+void Image::decode_bmp(const uint8_t *bytes, size_t len)
 {
+	PROFILE_SCOPE(OP_DECODE_BMP);
+	uint8_t *newData = NULL;
 	try
 	{
-		FILE* fp = fopen(filename, "r");
+		BMPHeader header;
+		parse_bmp_header(bytes, len, header);
+		BMPLayout layout;
+		check_bmp(header, len, layout);
+		int w = layout.width;
+		int h = layout.height;
+		int channels = layout.channels;
+
+		BitFields bf(header.masks.red, header.masks.green, header.masks.blue, header.masks.alpha);
+		size_t scanline_len = (size_t)w * channels;
+		newData = new uint8_t[scanline_len * h];
+
+		const uint8_t *rows = bytes + layout.data_offset;
+		for (int i = 0; i < h; i++)
+		{
+			int y = layout.top_down ? i : h - 1 - i;
+			unpack_bmp_row(layout.format, rows + i * layout.row_bytes, newData + y * scanline_len, w, bf, channels);
+		}
+
+		if (layout.bits <= 8)
+			set_palette_entries(bytes + layout.palette_offset, layout.palette_count);
+		else
+			release_palette();
+
+		adopt(newData);
+		width = w;
+		height = h;
+		bytespp = channels;
+		stride = w * channels;
+		PROFILE_PIXELS((uint64_t)w * h);
+	}
+	catch (const char* msg) 
+	{
+		delete[] newData;
+    std::cerr << msg << std::endl;
+  }
+}
+
+void Image::set_palette_entries(const uint8_t *entries, uint32_t count)
+{
+	if (count == 0)
+	{
+		set_Palette(BIT8);
+		return;
+	}
+	if (palette.size!=NUM_COLORS * RGBAQUAD)
+	{
+		release_palette();
+		palette.size = NUM_COLORS * RGBAQUAD;
+		palette.data = new uint8_t[palette.size];
+	}
+	memset(palette.data, 0, palette.size);
+	memcpy(palette.data, entries, count * RGBAQUAD);
+}
+
+BMPHeader Image::probe_bmp(const char *filename)
+{
+	BMPHeader header;
+	header.infoHeader.width_px = 0;
+	header.infoHeader.height_px = 0;
+	try
+	{
+		FILE* fp = fopen(filename, "rb");
 		if (fp==NULL)
 			throw "Could not open file";
 
+		uint8_t bytes[BMP_PROBE_SIZE];
+		size_t len = fread(bytes, 1, BMP_PROBE_SIZE, fp);
+		fclose(fp);
+
+		parse_bmp_header(bytes, len, header);
+	}
+	catch (const char* msg) 
+	{
+		header.infoHeader.width_px = 0;
+		header.infoHeader.height_px = 0;
+    std::cerr << msg << std::endl;
+  }
+	return header;
+}
+
+void Image::read_bmp_region(const char *filename, int x, int y, int w, int h)
+{
+	PROFILE_SCOPE(OP_READ_BMP_REGION);
+	FILE* fp = NULL;
+	uint8_t *newData = NULL;
+	try
+	{
+		fp = fopen(filename, "rb");
+		if (fp==NULL)
+			throw "Could not open file";
+
+		struct stat st;
+		if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode))
+			throw "Not a regular file";
+		size_t file_len = st.st_size;
+
+		uint8_t head[BMP_PROBE_SIZE];
+		size_t head_len = fread(head, 1, BMP_PROBE_SIZE, fp);
+
 		BMPHeader header;
-		uint32_t data_offset;
+		parse_bmp_header(head, head_len, header);
+		BMPLayout layout;
+		check_bmp(header, file_len, layout);
+		BMPPixelFormat format = layout.format;
+		int img_w = layout.width;
+		int img_h = layout.height;
+		bool top_down = layout.top_down;
 
-		fseek(fp, 10, SEEK_SET);
+		if (w <= 0 || h <= 0 || x < 0 || y < 0 || (int64_t)x + w > img_w || (int64_t)y + h > img_h)
+			throw "Region exceeds bounds of image.";
 
-		if (fread(&data_offset, 4, 1, fp)!=1)
-			throw "Could not read data from file";
+		int bits = layout.bits;
+		int channels = layout.channels;
+		size_t row_bytes = layout.row_bytes;
+		uint32_t data_offset = layout.data_offset;
 
-		rewind(fp);
+		// Sub-byte formats may start mid-byte; unpack from the containing byte.
+		size_t first_byte = (size_t)x * bits / BITS_PER_BYTE;
+		size_t last_byte = ((size_t)(x + w) * bits + BITS_PER_BYTE - 1) / BITS_PER_BYTE;
+		int skip = (int)(((size_t)x * bits % BITS_PER_BYTE) / bits);
+		std::vector<uint8_t> src(last_byte - first_byte);
+		std::vector<uint8_t> row((size_t)(w + skip) * channels);
 
-		if (fread(&header.fileHeader, BMP_FILEH_SIZE, 1, fp)!=1)
-			throw "Could not read data from file";
-		
-		if (fread(&header.infoHeader, BMP_INFH_SIZE, 1, fp)!=1)
-			throw "Could not read data from file";
+		BitFields bf(header.masks.red, header.masks.green, header.masks.blue, header.masks.alpha);
+		size_t scanline_len = (size_t)w * channels;
+		newData = new uint8_t[scanline_len * h];
 
-		if (header.infoHeader.bits_per_pixel<=8)
+		for (int i = 0; i < h; i++)
 		{
-			if (palette.size==0)
+			int file_row = top_down ? y + i : img_h - 1 - (y + i);
+			fseek(fp, data_offset + file_row * row_bytes + first_byte, SEEK_SET);
+			if (fread(&src[0], src.size(), 1, fp)!=1)
+				throw "Could not read data from file";
+			PROFILE_BYTES_READ(src.size());
+			if (skip == 0)
 			{
-				palette.size = (1 << header.infoHeader.bits_per_pixel) * RGBAQUAD;
-				palette.data = new uint8_t[palette.size];
+				unpack_bmp_row(format, &src[0], newData + i * scanline_len, w, bf, channels);
 			}
-			else 
+			else
 			{
-				palette.size = (1 << header.infoHeader.bits_per_pixel) * RGBAQUAD;
+				unpack_bmp_row(format, &src[0], &row[0], w + skip, bf, channels);
+				memcpy(newData + i * scanline_len, &row[skip * channels], scanline_len);
 			}
-			
-			if (fread(&palette.data[0], palette.size, 1, fp)!=1)
-				throw "Could not read data from file";
 		}
 
-		fseek(fp, data_offset, SEEK_SET);
-
-		height = header.infoHeader.height_px;
-		width = header.infoHeader.width_px;
-		bytespp = header.infoHeader.bits_per_pixel/BITS_PER_BYTE;
-		
-		uint32_t scanline_len = width * bytespp;
-		uint32_t nbytes = height * scanline_len;
-		uint32_t padding = 4 - (scanline_len % 4);
-		
-		data = new uint8_t[nbytes];
-
-		for (int i = height - 1; i >= 0; i--)
+		if (bits <= 8)
 		{
-			int y_pos = i*width*bytespp;
-			for (size_t j = 0; j < width; j++)
-			{
-				int x_pos = j*bytespp;
-				for (int k = bytespp - 1; k >= 0; k--)
-				{
-					if (fread(&data[y_pos + x_pos + k], sizeof(uint8_t), 1, fp)!=1)
-						throw "Could not read data from file";
-				}
-			}
-			if (padding!=4)
-				fseek(fp, 4 - (scanline_len % 4), SEEK_CUR);
+			uint32_t count = layout.palette_count;
+			std::vector<uint8_t> entries(count * RGBAQUAD + 1);
+			fseek(fp, layout.palette_offset, SEEK_SET);
+			if (count > 0 && fread(&entries[0], count * RGBAQUAD, 1, fp)!=1)
+				throw "Could not read data from file";
+			set_palette_entries(&entries[0], count);
+		}
+		else
+		{
+			release_palette();
 		}
 		fclose(fp);
+
+		adopt(newData);
+		width = w;
+		height = h;
+		bytespp = channels;
+		stride = w * channels;
+		PROFILE_PIXELS((uint64_t)w * h);
 	}
 	catch (const char* msg) 
 	{
+		if (fp)
+			fclose(fp);
+		delete[] newData;
     std::cerr << msg << std::endl;
   }
 }
@@ -239,52 +836,100 @@ void Image::to_rgb()
 	if (bytespp==2)
 		throw "Not yet supported.";
 
-	uint8_t* newData = new uint8_t[width*height*RGB];
+	if (bytespp==RGB)
+		return;
 
-	if (bytespp==1)
-		if (palette.size==0)
-		{
-			int nbytes = width*height;
+	PROFILE_SCOPE(OP_CONVERT);
+	size_t npixels = (size_t)width*height;
+	PROFILE_PIXELS(npixels);
+	uint8_t* newData = new uint8_t[npixels*RGB];
 
-			for (size_t i = 0; i < nbytes; i++)
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t *src = data + (size_t)y * stride;
+		uint8_t *dst = newData + (size_t)y * width * RGB;
+		if (bytespp==1 && palette.size>0)
+		{
+			expand_palette_row(src, dst, width, palette.data);
+		}
+		else if (bytespp==1)
+		{
+			for (int i = 0; i < width; i++)
 			{
-				uint8_t px = data[i];
-				
-				newData[i * RGB		 ] = palette.data[px * RGBA];
-				newData[i * RGB + 1] = palette.data[px * RGBA + 1];
-				newData[i * RGB + 2] = palette.data[px * RGBA + 2];
+				dst[i * RGB    ] = src[i];
+				dst[i * RGB + 1] = src[i];
+				dst[i * RGB + 2] = src[i];
+			}
+		}
+		else
+		{
+			for (int i = 0; i < width; i++)
+			{
+				dst[i * RGB    ] = src[i * RGBA    ];
+				dst[i * RGB + 1] = src[i * RGBA + 1];
+				dst[i * RGB + 2] = src[i * RGBA + 2];
 			}
-
-			delete[] data;
-			data = newData;
-			bytespp = 3;
-			delete[] palette.data;
-			palette.size = 0;
 		}
-
-	if (bytespp==4)
-	{
-		
 	}
 
+	if (bytespp==1)
+		release_palette();
+	adopt(newData);
+	bytespp = RGB;
+	stride = width * RGB;
 }
 
 
 void Image::to_rgba()
 {
+	if (bytespp==RGBA)
+		return;
+
+	to_rgb();
 
+	PROFILE_SCOPE(OP_CONVERT);
+	size_t npixels = (size_t)width*height;
+	PROFILE_PIXELS(npixels);
+	uint8_t* newData = new uint8_t[npixels*RGBA];
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t *src = data + (size_t)y * stride;
+		uint8_t *dst = newData + (size_t)y * width * RGBA;
+		for (int i = 0; i < width; i++)
+		{
+			dst[i * RGBA    ] = src[i * RGB    ];
+			dst[i * RGBA + 1] = src[i * RGB + 1];
+			dst[i * RGBA + 2] = src[i * RGB + 2];
+			dst[i * RGBA + 3] = 0xFF;
+		}
+	}
+
+	adopt(newData);
+	bytespp = RGBA;
+	stride = width * RGBA;
 }
 
+
 void Image::to_grayscale()
 {
 
 }
 
-int Image::get_bytespp()
+int Image::get_bytespp() const
 {
 	return bytespp;
 }
 
+int Image::get_stride() const
+{
+	return stride;
+}
+
+bool Image::is_view() const
+{
+	return borrowed;
+}
+
 void Image::set_Palette(PaletteDefault p)
 {
 	if (p == PaletteDefault::BIT8)
@@ -306,22 +951,74 @@ void Image::set_Palette(PaletteDefault p)
 	}
 }
 
-int Image::get_width()
+bool Image::is_grayscale() const
+{
+	if (bytespp!=1)
+		return false;
+	for (int i = 0; i < palette.size / RGBAQUAD; i++)
+	{
+		const uint8_t *entry = palette.data + i * RGBAQUAD;
+		if (entry[0]!=i || entry[1]!=i || entry[2]!=i)
+			return false;
+	}
+	return true;
+}
+
+void Image::set_Palette(const uint8_t *entries, int count)
+{
+	if (count > NUM_COLORS)
+		count = NUM_COLORS;
+	set_palette_entries(entries, count);
+}
+
+int Image::get_width() const
 {
 	return width;
 }
 
-int Image::get_height()
+int Image::get_height() const
 {
 	return height;
 }
 
 uint8_t* Image::buffer()
+{
+	detach();
+	return data;
+}
+
+const uint8_t* Image::buffer() const
 {
 	return data;
 }
 
+uint8_t* Image::palette_buffer()
+{
+	return palette.data;
+}
+
+const uint8_t* Image::palette_buffer() const
+{
+	return palette.data;
+}
+
+int Image::get_palette_size() const
+{
+	return palette.size;
+}
+
 void Image::clear()
 {
-	memset((void *)data, 0, width * height * bytespp);
+	if (!data)
+		return;
+	size_t line = (size_t)width * bytespp;
+	if (borrowed)
+	{
+		for (int y = 0; y < height; y++)
+			memset(data + (size_t)y * stride, 0, line);
+		return;
+	}
+	if (shared())
+		adopt(new uint8_t[line * height]);
+	memset((void *)data, 0, line * height);
 }
\ No newline at end of file
@@ -1,9 +1,11 @@
 #ifndef __IMAGE_H__
 #define __IMAGE_H__
 
+#include <atomic>
 #include <fstream>
 #include <Eigen/Dense>
 #include <iostream>
+#include <vector>
 
 using namespace Eigen;
 
@@ -18,6 +20,13 @@ using namespace Eigen;
 #define BITS_PER_BYTE       8
 #define RESERVED						0
 #define RGBAQUAD						4
+#define BMP_V4_SIZE					108
+#define BMP_V5_SIZE					124
+#define BMP_PROBE_SIZE			(BMP_FILEH_SIZE + BMP_V5_SIZE + 4 * RGBAQUAD)
+#define BI_RGB							0
+#define BI_BITFIELDS				3
+#define BI_ALPHABITFIELDS		6
+#define LCS_SRGB						0x73524742	// 'sRGB' colour space of V4 headers
 
 struct BMPHeader
 {
@@ -51,8 +60,8 @@ struct BMPHeader
 	struct InfoHeader
 	{
 		uint32_t info_header_size;	// DIB Header size in bytes (40 bytes)
-		uint32_t width_px;					// Width of the image
-		uint32_t height_px;					// Height of image
+		int32_t width_px;						// Width of the image
+		int32_t height_px;					// Height of image, negative for top-down images
 		uint16_t num_planes;				// Number of color planes
 		uint16_t bits_per_pixel;		// Bits per pixel
 		uint32_t compression;				// Compression type
@@ -76,21 +85,34 @@ struct BMPHeader
 	};
 	#pragma pack(pop)
 
+	struct BitMasks
+	{
+		uint32_t red;
+		uint32_t green;
+		uint32_t blue;
+		uint32_t alpha;
+
+		BitMasks() : red(0), green(0), blue(0), alpha(0)
+		{
+		}
+	};
+
 	FileHeader fileHeader;
 	InfoHeader infoHeader;
+	BitMasks masks;					// Channel masks for 16 and 32 bit images
 	
 	int paletteSz;
 	#pragma pack(push, 1)
 	uint8_t* palette;
 	#pragma pack(pop)
 
-	BMPHeader()
+	BMPHeader() : paletteSz(0), palette(NULL)
 	{
 	}
 
 	BMPHeader(uint32_t width, uint32_t height, uint16_t bytespp, uint32_t fileSize, uint32_t image_size) :
 	fileHeader(fileSize), infoHeader(width, height, bytespp, image_size)
-	, paletteSz(0)
+	, paletteSz(0), palette(NULL)
 	{
 	}
 
@@ -124,20 +146,45 @@ class Image
 		{
 		}
 
-		Palette(int size) : size(size)
+		Palette(int size) : size(size), data(NULL)
 		{
-			data = new uint8_t[size];
+			if (size > 0)
+				data = new uint8_t[size];
 		}
 	};
 	#pragma pack(pop)
 
+	// Pixel storage shared by copies of an Image until one of them writes.
+	// Copies of an image with live sub-image views get their own pixels, so
+	// writes through a view only ever reach the image it was taken from.
+	struct PixelBuffer
+	{
+		std::atomic<int> refs;		// Images and views holding the buffer
+		std::atomic<int> views;		// Of which views
+		uint8_t *bytes;
+	};
+
+	PixelBuffer *pixels;
+	bool borrowed;		// A view into another image's pixels
+
 protected:
 	uint8_t* data;
 	int width;
 	int height;
 	int bytespp;
+	int stride;			// Bytes from one row to the next
 	Palette palette;
 
+	void release_palette();
+	void release_pixels();
+	void adopt(uint8_t *bytes);
+	void detach();
+	bool shared() const;
+	bool shareable() const;
+	uint8_t *packed_copy() const;
+	void copy_palette(const Palette &p);
+	void set_palette_entries(const uint8_t *entries, uint32_t count);
+
 public:
 	enum Format
 	{
@@ -155,8 +202,24 @@ public:
 	Image(int h, int w, int bpp);
 	Image(const Image &img);
 
+	// Sub-image view of the w x h rectangle at (x, y) of parent. Reads and
+	// writes go straight to the parent's pixels, and the view keeps those
+	// pixels alive. If the parent is destroyed or replaces its pixels (by
+	// assignment, read_bmp, to_rgb, scale and so on), the view keeps the old
+	// pixels and no longer shares writes with the parent. Copying a view
+	// copies its pixels; anything that replaces them, such as to_rgb or
+	// read_bmp, turns the view into an image of its own. Views of one parent
+	// must be made from one thread at a time; they can then be used from
+	// several.
+	Image(Image &parent, int x, int y, int w, int h);
+
 	void read_bmp(const char *filename);
+	void decode_bmp(const uint8_t *bytes, size_t len);
+	void read_bmp_region(const char *filename, int x, int y, int w, int h);
+	static BMPHeader probe_bmp(const char *filename);
 	void write_bmp(const char *filename, bool improvise_palette = false);
+	// The bytes write_bmp would write, without the palette improvisation.
+	void encode_bmp(std::vector<uint8_t> &bytes) const;
 
 	void printData();
 	void to_rgb();
@@ -165,11 +228,21 @@ public:
 
 	~Image();
 	Image &operator=(const Image &img);
-	int get_width();
-	int get_height();
-	int get_bytespp();
+	int get_width() const;
+	int get_height() const;
+	int get_bytespp() const;
+	int get_stride() const;
+	bool is_view() const;
 	void set_Palette(PaletteDefault p);
+	void set_Palette(const uint8_t *entries, int count);
+	bool is_grayscale() const;
+	// Copies share pixels until one of them is written. The writable buffer
+	// detaches this image from its copies, so fetch it again after copying.
 	uint8_t *buffer();
+	const uint8_t *buffer() const;
+	uint8_t *palette_buffer();
+	const uint8_t *palette_buffer() const;
+	int get_palette_size() const;
 	void clear();
 };
 
@@ -0,0 +1,321 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <iostream>
+
+#include "ImageCache.h"
+#include "MappedFile.h"
+#include "Profile.h"
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t v)
+{
+	acc += v * PRIME2;
+	return rotl(acc, 31) * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t acc, uint64_t v)
+{
+	acc ^= round64(0, v);
+	return acc * PRIME1 + PRIME4;
+}
+
+// xxHash64 with a zero seed. Four independent lanes keep the multiplier busy,
+// so hashing runs at memory speed and costs far less than decoding.
+static uint64_t hash_bytes(const uint8_t *p, size_t len)
+{
+	const uint8_t *end = p + len;
+	uint64_t h;
+
+	if (len >= 32)
+	{
+		uint64_t v1 = PRIME1 + PRIME2;
+		uint64_t v2 = PRIME2;
+		uint64_t v3 = 0;
+		uint64_t v4 = 0 - PRIME1;
+		for (; p + 32 <= end; p += 32)
+		{
+			v1 = round64(v1, load64(p));
+			v2 = round64(v2, load64(p + 8));
+			v3 = round64(v3, load64(p + 16));
+			v4 = round64(v4, load64(p + 24));
+		}
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+		h = merge64(h, v1);
+		h = merge64(h, v2);
+		h = merge64(h, v3);
+		h = merge64(h, v4);
+	}
+	else
+	{
+		h = PRIME5;
+	}
+
+	h += len;
+	for (; p + 8 <= end; p += 8)
+		h = rotl(h ^ round64(0, load64(p)), 27) * PRIME1 + PRIME4;
+	if (p + 4 <= end)
+	{
+		uint32_t v;
+		memcpy(&v, p, sizeof(v));
+		h = rotl(h ^ (v * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++)
+		h = rotl(h ^ (*p * PRIME5), 11) * PRIME1;
+
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool ImageCache::FileId::operator==(const FileId &o) const
+{
+	return dev == o.dev && ino == o.ino && size == o.size && mtime == o.mtime;
+}
+
+bool ImageCache::ContentKey::operator==(const ContentKey &o) const
+{
+	return hash == o.hash && size == o.size;
+}
+
+size_t ImageCache::Hasher::operator()(const FileId &id) const
+{
+	return (size_t)(id.ino * PRIME1 ^ id.dev * PRIME2 ^ id.mtime * PRIME3 ^ id.size);
+}
+
+size_t ImageCache::Hasher::operator()(const ContentKey &key) const
+{
+	return (size_t)(key.hash ^ key.size * PRIME1);
+}
+
+ImageCache::ImageCache(size_t budget) : budget(budget), on(true)
+{
+	memset(&counters, 0, sizeof(counters));
+}
+
+static ImageCache *make_shared_cache()
+{
+	ImageCache *cache = new ImageCache();
+	cache->disable();
+	const char *mb = getenv("IMAGE_CACHE_MB");
+	if (mb && atol(mb) > 0)
+		cache->enable((size_t)atol(mb) << 20);
+	return cache;
+}
+
+// Never destroyed, so images read during static destruction still work.
+ImageCache &ImageCache::shared()
+{
+	static ImageCache *cache = make_shared_cache();
+	return *cache;
+}
+
+bool ImageCache::stat_file(const char *filename, FileId &id)
+{
+	struct stat st;
+	if (stat(filename, &st) != 0)
+		return false;
+	id.dev = st.st_dev;
+	id.ino = st.st_ino;
+	id.size = st.st_size;
+	id.mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000u + st.st_mtim.tv_nsec;
+	return true;
+}
+
+// Whether path, still the file it was when id was taken, holds the same bytes
+// as file. Equal hashes alone could be a collision.
+bool ImageCache::same_contents(const std::string &path, const FileId &id, const MappedFile &file)
+{
+	FileId now;
+	if (!stat_file(path.c_str(), now) || !(now == id))
+		return false;
+	MappedFile other;
+	return other.open(path.c_str()) && other.length() == file.length() &&
+	       memcmp(other.bytes(), file.bytes(), file.length()) == 0;
+}
+
+std::shared_ptr<const Image> ImageCache::lookup(const ContentKey &key, const FileId *id)
+{
+	std::unordered_map<ContentKey, Lru::iterator, Hasher>::iterator it = entries.find(key);
+	if (it == entries.end())
+		return std::shared_ptr<const Image>();
+
+	Entry &entry = *it->second;
+	lru.splice(lru.begin(), lru, it->second);
+	if (id && files.insert(std::make_pair(*id, key)).second)
+		entry.files.push_back(*id);
+	counters.hits++;
+	return entry.image;
+}
+
+std::shared_ptr<const Image> ImageCache::insert(const ContentKey &key, const FileId &id, const char *filename, const std::shared_ptr<const Image> &image)
+{
+	counters.misses++;
+
+	// An entry under the same key did not match these contents, or another
+	// thread decoded them while this one did. Either way this image is good.
+	std::unordered_map<ContentKey, Lru::iterator, Hasher>::iterator it = entries.find(key);
+	if (it != entries.end())
+		remove(it->second);
+
+	size_t bytes = (size_t)image->get_width() * image->get_height() * image->get_bytespp() + image->get_palette_size();
+	if (bytes > budget)
+		return image;
+
+	Entry entry;
+	entry.key = key;
+	entry.image = image;
+	entry.bytes = bytes;
+	entry.files.push_back(id);
+	entry.path = filename;
+	lru.push_front(entry);
+	entries[key] = lru.begin();
+	files[id] = key;
+	counters.bytes += bytes;
+	counters.entries++;
+	evict(budget);
+	return image;
+}
+
+void ImageCache::remove(Lru::iterator entry)
+{
+	for (size_t i = 0; i < entry->files.size(); i++)
+		files.erase(entry->files[i]);
+	entries.erase(entry->key);
+	counters.bytes -= entry->bytes;
+	counters.entries--;
+	lru.erase(entry);
+}
+
+void ImageCache::evict(size_t limit)
+{
+	while (counters.bytes > limit && !lru.empty())
+	{
+		remove(--lru.end());
+		counters.evictions++;
+	}
+}
+
+std::shared_ptr<const Image> ImageCache::read_bmp(const char *filename)
+{
+	PROFILE_SCOPE(OP_READ_BMP);
+	try
+	{
+		FileId id;
+		if (!stat_file(filename, id))
+			throw "Could not open file";
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::unordered_map<FileId, ContentKey, Hasher>::iterator it = files.find(id);
+			if (it != files.end())
+			{
+				std::shared_ptr<const Image> image = lookup(it->second, NULL);
+				if (image)
+					return image;
+				files.erase(it);
+			}
+		}
+
+		MappedFile file;
+		if (!file.open(filename))
+			return std::shared_ptr<const Image>();
+		PROFILE_BYTES_READ(file.length());
+
+		ContentKey key;
+		key.hash = hash_bytes(file.bytes(), file.length());
+		key.size = file.length();
+
+		// Compared outside the lock, since it reads the other file.
+		std::string path;
+		FileId path_id;
+		std::shared_ptr<const Image> candidate;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::unordered_map<ContentKey, Lru::iterator, Hasher>::iterator it = entries.find(key);
+			if (it != entries.end())
+			{
+				path = it->second->path;
+				path_id = it->second->files[0];
+				candidate = it->second->image;
+			}
+		}
+		if (candidate && same_contents(path, path_id, file))
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::unordered_map<ContentKey, Lru::iterator, Hasher>::iterator it = entries.find(key);
+			if (it != entries.end() && it->second->image == candidate)
+				return lookup(key, &id);
+		}
+
+		// Decoded outside the lock so that misses on different files overlap.
+		std::shared_ptr<Image> image = std::make_shared<Image>();
+		image->decode_bmp(file.bytes(), file.length());
+		if (!image->buffer())
+			return std::shared_ptr<const Image>();
+
+		std::lock_guard<std::mutex> guard(lock);
+		return insert(key, id, filename, image);
+	}
+	catch (const char* msg)
+	{
+		std::cerr << msg << std::endl;
+		return std::shared_ptr<const Image>();
+	}
+}
+
+void ImageCache::enable(size_t limit)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	budget = limit;
+	evict(budget);
+	on = true;
+}
+
+void ImageCache::disable()
+{
+	on = false;
+	clear();
+}
+
+bool ImageCache::enabled()
+{
+	return on;
+}
+
+void ImageCache::clear()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	lru.clear();
+	entries.clear();
+	files.clear();
+	counters.bytes = 0;
+	counters.entries = 0;
+}
+
+ImageCacheStats ImageCache::stats()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return counters;
+}
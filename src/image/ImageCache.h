@@ -0,0 +1,108 @@
+#ifndef __IMAGE_CACHE_H__
+#define __IMAGE_CACHE_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Image.h"
+
+class MappedFile;
+
+#define DEFAULT_CACHE_BUDGET    (256u << 20)
+
+struct ImageCacheStats
+{
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t bytes;				// Decoded bytes currently held
+	uint64_t entries;
+};
+
+// LRU cache of decoded BMPs, bounded by the bytes of the decoded images it
+// holds. Entries are keyed by a 64-bit hash and the length of the file's
+// contents, so the same image under different paths is decoded once; a file
+// that matches an entry's key is compared byte for byte with the file the
+// entry was decoded from before the entry is used. A file whose device,
+// inode, size and modification time were seen before is found without
+// reading it again.
+//
+// Images are handed out as shared, immutable buffers; an evicted image stays
+// alive for as long as a caller holds it. Copy one into an Image or a Sketch
+// to modify it.
+//
+// Image::read_bmp goes through the shared cache once it is enabled, either
+// with ImageCache::shared().enable() or by setting IMAGE_CACHE_MB in the
+// environment.
+class ImageCache
+{
+	struct FileId
+	{
+		uint64_t dev, ino, size, mtime;
+		bool operator==(const FileId &o) const;
+	};
+
+	struct ContentKey
+	{
+		uint64_t hash, size;
+		bool operator==(const ContentKey &o) const;
+	};
+
+	struct Hasher
+	{
+		size_t operator()(const FileId &id) const;
+		size_t operator()(const ContentKey &key) const;
+	};
+
+	struct Entry
+	{
+		ContentKey key;
+		std::shared_ptr<const Image> image;
+		size_t bytes;
+		std::vector<FileId> files;
+		std::string path;		// Decoded from, as files[0]
+	};
+
+	typedef std::list<Entry> Lru;
+
+	std::mutex lock;
+	Lru lru;		// Most recently used first
+	std::unordered_map<ContentKey, Lru::iterator, Hasher> entries;
+	std::unordered_map<FileId, ContentKey, Hasher> files;
+	size_t budget;
+	std::atomic<bool> on;
+	ImageCacheStats counters;
+
+	static bool stat_file(const char *filename, FileId &id);
+	static bool same_contents(const std::string &path, const FileId &id, const MappedFile &file);
+	std::shared_ptr<const Image> lookup(const ContentKey &key, const FileId *id);
+	std::shared_ptr<const Image> insert(const ContentKey &key, const FileId &id, const char *filename, const std::shared_ptr<const Image> &image);
+	void remove(Lru::iterator entry);
+	void evict(size_t budget);
+
+	ImageCache(const ImageCache &);
+	ImageCache &operator=(const ImageCache &);
+
+public:
+	ImageCache(size_t budget = DEFAULT_CACHE_BUDGET);
+
+	static ImageCache &shared();
+
+	// Returns NULL, after printing why, when the file cannot be read or
+	// decoded.
+	std::shared_ptr<const Image> read_bmp(const char *filename);
+
+	void enable(size_t budget = DEFAULT_CACHE_BUDGET);
+	void disable();
+	bool enabled();
+	void clear();
+	ImageCacheStats stats();
+};
+
+#endif //__IMAGE_CACHE_H__
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "ImageT.h"
+#include "Kernels.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+static void widen_row(const uint8_t *src, uint16_t *dst, int n)
+{
+	u8_to_u16_row(src, dst, n);
+}
+
+static void widen_row(const uint8_t *src, float *dst, int n)
+{
+	u8_to_f32_row(src, dst, n);
+}
+
+static void narrow_row(const uint16_t *src, uint8_t *dst, int n)
+{
+	u16_to_u8_row(src, dst, n);
+}
+
+static void narrow_row(const float *src, uint8_t *dst, int n)
+{
+	f32_to_u8_row(src, dst, n);
+}
+
+template <typename T>
+ImageT<T>::ImageT() : width(0), height(0), channels(0)
+{
+}
+
+template <typename T>
+ImageT<T>::ImageT(int h, int w, int channels) :
+data((size_t)w * h * channels), width(w), height(h), channels(channels)
+{
+}
+
+template <typename T>
+bool ImageT<T>::from_image(const Image &img)
+{
+	if (!img.buffer())
+		return false;
+	PROFILE_SCOPE(OP_CONVERT);
+
+	Image expanded;
+	const Image *src = &img;
+	if (img.get_bytespp()==1 && !img.is_grayscale())
+	{
+		expanded = img;
+		expanded.to_rgb();
+		src = &expanded;
+	}
+
+	int w = src->get_width();
+	int h = src->get_height();
+	int c = src->get_bytespp();
+	*this = ImageT<T>(h, w, c);
+	PROFILE_PIXELS((uint64_t)w * h);
+
+	size_t line = (size_t)w * c;
+	size_t stride = src->get_stride();
+	const uint8_t *in = src->buffer();
+	T *out = &data[0];
+	parallel_bands(h, [=](int begin, int end) {
+		for (int y = begin; y < end; y++)
+			widen_row(in + y * stride, out + y * line, line);
+	});
+	return true;
+}
+
+template <typename T>
+bool ImageT<T>::to_image(Image &img) const
+{
+	if (data.empty())
+		return false;
+	PROFILE_SCOPE(OP_CONVERT);
+	PROFILE_PIXELS((uint64_t)width * height);
+
+	img = Image(height, width, channels);
+	size_t line = (size_t)width * channels;
+	const T *in = &data[0];
+	uint8_t *out = img.buffer();
+	parallel_bands(height, [=](int begin, int end) {
+		for (int y = begin; y < end; y++)
+			narrow_row(in + y * line, out + y * line, line);
+	});
+	return true;
+}
+
+template <typename T>
+bool ImageT<T>::read_raw(const char *filename, int w, int h, int c)
+{
+	FILE *fp = NULL;
+	try
+	{
+		if (w <= 0 || h <= 0 || c <= 0)
+			throw "Invalid raw image dimensions";
+		fp = fopen(filename, "rb");
+		if (fp==NULL)
+			throw "Could not open file";
+
+		ImageT<T> tmp(h, w, c);
+		if (fread(&tmp.data[0], tmp.data.size() * sizeof(T), 1, fp)!=1)
+			throw "Could not read data from file";
+		fclose(fp);
+		*this = tmp;
+		return true;
+	}
+	catch (const char* msg)
+	{
+		if (fp)
+			fclose(fp);
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
+
+template <typename T>
+bool ImageT<T>::write_raw(const char *filename) const
+{
+	FILE *fp = NULL;
+	try
+	{
+		if (data.empty())
+			throw "Nothing to write";
+		fp = fopen(filename, "wb");
+		if (fp==NULL)
+			throw "Could not open file";
+		if (fwrite(&data[0], data.size() * sizeof(T), 1, fp)!=1)
+			throw "Could not write data to file";
+		fclose(fp);
+		return true;
+	}
+	catch (const char* msg)
+	{
+		if (fp)
+			fclose(fp);
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
+
+template <typename T>
+int ImageT<T>::get_width() const
+{
+	return width;
+}
+
+template <typename T>
+int ImageT<T>::get_height() const
+{
+	return height;
+}
+
+template <typename T>
+int ImageT<T>::get_channels() const
+{
+	return channels;
+}
+
+template <typename T>
+T *ImageT<T>::buffer()
+{
+	return data.empty() ? NULL : &data[0];
+}
+
+template <typename T>
+const T *ImageT<T>::buffer() const
+{
+	return data.empty() ? NULL : &data[0];
+}
+
+template <typename T>
+T *ImageT<T>::row(int y)
+{
+	return &data[(size_t)y * width * channels];
+}
+
+template <typename T>
+const T *ImageT<T>::row(int y) const
+{
+	return &data[(size_t)y * width * channels];
+}
+
+template <typename T>
+void ImageT<T>::clear()
+{
+	std::fill(data.begin(), data.end(), T());
+}
+
+template class ImageT<uint16_t>;
+template class ImageT<float>;
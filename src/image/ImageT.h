@@ -0,0 +1,52 @@
+#ifndef __IMAGE_T_H__
+#define __IMAGE_T_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Image.h"
+
+// Packed, top-down images with 16-bit or float channels, for processing
+// chains that should not round to 8 bits between stages. Channel order
+// matches Image (gray, RGB or RGBA). Float channels are nominally in [0, 1]
+// but are never clamped, so they also hold arbitrary scientific data;
+// 16-bit channels span [0, 65535].
+template <typename T>
+class ImageT
+{
+	std::vector<T> data;
+	int width;
+	int height;
+	int channels;
+
+public:
+	typedef T channel_type;
+
+	ImageT();
+	ImageT(int h, int w, int channels);
+
+	// Widens an 8-bit image. Indexed images are expanded through their
+	// palette unless it is a gray ramp.
+	bool from_image(const Image &img);
+	// Narrows to 8 bits, rounding and clamping every channel.
+	bool to_image(Image &img) const;
+
+	// Raw files hold h rows of w * channels native-endian samples of T, top
+	// row first, as dumped by most simulation and GIS tools.
+	bool read_raw(const char *filename, int w, int h, int channels);
+	bool write_raw(const char *filename) const;
+
+	int get_width() const;
+	int get_height() const;
+	int get_channels() const;
+	T *buffer();
+	const T *buffer() const;
+	T *row(int y);
+	const T *row(int y) const;
+	void clear();
+};
+
+typedef ImageT<uint16_t> Image16;
+typedef ImageT<float> ImageF;
+
+#endif //__IMAGE_T_H__
@@ -0,0 +1,42 @@
+#ifndef __KERNEL_VARIANTS_H__
+#define __KERNEL_VARIANTS_H__
+
+#include <stdint.h>
+
+// Every variant of the dispatched kernels in Dispatch.h. The scalar ones are
+// the reference the others must match. The rest exist only in x86 builds,
+// which always have SSE2, and must only be called when cpu_detect() reports
+// their level.
+
+void expand_palette_row_scalar(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+void swap_rb24_row_scalar(const uint8_t *src, uint8_t *dst, int width);
+void swap_rb32_row_scalar(const uint8_t *src, uint8_t *dst, int width);
+void fill_row_scalar(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+void blend_over_row_scalar(float *dst, int channels, const float *src, int width, float opacity);
+void downsample2x_row_scalar(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels);
+
+#ifdef __SSE2__
+#define KERNELS_X86
+
+void swap_rb32_row_sse2(const uint8_t *src, uint8_t *dst, int width);
+void fill_row_sse2(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+void blend_over_row_sse2(float *dst, int channels, const float *src, int width, float opacity);
+void downsample2x_row_sse2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels);
+
+void expand_palette_row_sse42(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+void swap_rb24_row_sse42(const uint8_t *src, uint8_t *dst, int width);
+void swap_rb32_row_sse42(const uint8_t *src, uint8_t *dst, int width);
+
+void expand_palette_row_avx2(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+void swap_rb32_row_avx2(const uint8_t *src, uint8_t *dst, int width);
+void fill_row_avx2(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+void blend_over_row_avx2(float *dst, int channels, const float *src, int width, float opacity);
+void downsample2x_row_avx2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels);
+
+void expand_palette_row_avx512(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+void swap_rb32_row_avx512(const uint8_t *src, uint8_t *dst, int width);
+void fill_row_avx512(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+void blend_over_row_avx512(float *dst, int channels, const float *src, int width, float opacity);
+#endif
+
+#endif //__KERNEL_VARIANTS_H__
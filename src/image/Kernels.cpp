@@ -0,0 +1,678 @@
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Dispatch.h"
+#include "KernelVariants.h"
+#include "Kernels.h"
+
+static inline uint16_t load16(const uint8_t *p)
+{
+	uint16_t v;
+	memcpy(&v, p, 2);
+	return v;
+}
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+BitFields::BitFields(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+	mask[0] = r;
+	mask[1] = g;
+	mask[2] = b;
+	mask[3] = a;
+	for (int c = 0; c < 4; c++)
+	{
+		shift[c] = 0;
+		bits[c] = 0;
+		if (mask[c] == 0)
+			continue;
+		while (((mask[c] >> shift[c]) & 1) == 0)
+			shift[c]++;
+		while (bits[c] + shift[c] < 32 && ((mask[c] >> (shift[c] + bits[c])) & 1))
+			bits[c]++;
+
+		if (bits[c] <= 8)
+		{
+			uint32_t max = (1u << bits[c]) - 1;
+			for (uint32_t i = 0; i <= max; i++)
+				scale[c][i] = (uint8_t)((i * 255 + (max >> 1)) / max);
+		}
+	}
+}
+
+static inline uint8_t bitfield_channel(uint32_t v, const BitFields &bf, int c)
+{
+	if (bf.bits[c] == 0)
+		return c == 3 ? 0xFF : 0x00;
+	uint32_t x = (v & bf.mask[c]) >> bf.shift[c];
+	if (bf.bits[c] > 8)
+		return (uint8_t)(x >> (bf.bits[c] - 8));
+	return bf.scale[c][x];
+}
+
+void unpack_pal1_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++)
+		dst[x] = (src[x >> 3] >> (7 - (x & 7))) & 0x01;
+}
+
+void unpack_pal4_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++)
+		dst[x] = (x & 1) ? (src[x >> 1] & 0x0F) : (src[x >> 1] >> 4);
+}
+
+void unpack_pal8_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	memcpy(dst, src, width);
+}
+
+void swap_rb24_row_scalar(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++, src += 3, dst += 3)
+	{
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+
+void swap_rb32_row_scalar(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++)
+	{
+		uint32_t v = load32(src + 4 * x);
+		v = (v & 0xFF00FF00) | ((v >> 16) & 0x000000FF) | ((v & 0x000000FF) << 16);
+		memcpy(dst + 4 * x, &v, 4);
+	}
+}
+
+#ifdef KERNELS_X86
+void swap_rb32_row_sse2(const uint8_t *src, uint8_t *dst, int width)
+{
+	const __m128i ga = _mm_set1_epi32((int)0xFF00FF00);
+	const __m128i low = _mm_set1_epi32(0x000000FF);
+	int x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+		__m128i r = _mm_and_si128(_mm_srli_epi32(v, 16), low);
+		__m128i b = _mm_slli_epi32(_mm_and_si128(v, low), 16);
+		v = _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(r, b));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), v);
+	}
+	swap_rb32_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+#endif
+
+void unpack_bgr24_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	kernels().swap_rb24_row(src, dst, width);
+}
+
+void unpack_bgra32_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	kernels().swap_rb32_row(src, dst, width);
+}
+
+void unpack_bgrx32_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++, src += 4, dst += 3)
+	{
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+
+void unpack_rgb565_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++, dst += 3)
+	{
+		uint16_t v = load16(src + 2 * x);
+		uint8_t r = (v >> 11) & 0x1F;
+		uint8_t g = (v >> 5) & 0x3F;
+		uint8_t b = v & 0x1F;
+		dst[0] = (r << 3) | (r >> 2);
+		dst[1] = (g << 2) | (g >> 4);
+		dst[2] = (b << 3) | (b >> 2);
+	}
+}
+
+void unpack_rgb555_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	for (int x = 0; x < width; x++, dst += 3)
+	{
+		uint16_t v = load16(src + 2 * x);
+		uint8_t r = (v >> 10) & 0x1F;
+		uint8_t g = (v >> 5) & 0x1F;
+		uint8_t b = v & 0x1F;
+		dst[0] = (r << 3) | (r >> 2);
+		dst[1] = (g << 3) | (g >> 2);
+		dst[2] = (b << 3) | (b >> 2);
+	}
+}
+
+void unpack_bitfields16_row(const uint8_t *src, uint8_t *dst, int width, const BitFields &bf, int channels)
+{
+	for (int x = 0; x < width; x++, dst += channels)
+	{
+		uint32_t v = load16(src + 2 * x);
+		for (int c = 0; c < channels; c++)
+			dst[c] = bitfield_channel(v, bf, c);
+	}
+}
+
+void unpack_bitfields32_row(const uint8_t *src, uint8_t *dst, int width, const BitFields &bf, int channels)
+{
+	for (int x = 0; x < width; x++, dst += channels)
+	{
+		uint32_t v = load32(src + 4 * x);
+		for (int c = 0; c < channels; c++)
+			dst[c] = bitfield_channel(v, bf, c);
+	}
+}
+
+void expand_palette_row_scalar(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette)
+{
+	for (int x = 0; x < width; x++, dst += 3)
+	{
+		const uint8_t *entry = palette + 4 * src[x];
+		dst[0] = entry[2];
+		dst[1] = entry[1];
+		dst[2] = entry[0];
+	}
+}
+
+void expand_palette_row(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette)
+{
+	kernels().expand_palette_row(src, dst, width, palette);
+}
+
+void pack_bgr24_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	kernels().swap_rb24_row(src, dst, width);
+}
+
+void pack_bgra32_row(const uint8_t *src, uint8_t *dst, int width)
+{
+	kernels().swap_rb32_row(src, dst, width);
+}
+
+void fill_row_scalar(uint8_t *dst, int width, const uint8_t *pixel, int channels)
+{
+	if (channels == 1)
+	{
+		memset(dst, pixel[0], width);
+		return;
+	}
+	for (int x = 0; x < width; x++, dst += channels)
+		for (int c = 0; c < channels; c++)
+			dst[c] = pixel[c];
+}
+
+#ifdef KERNELS_X86
+void fill_row_sse2(uint8_t *dst, int width, const uint8_t *pixel, int channels)
+{
+	int x = 0;
+	if (channels == 4)
+	{
+		const __m128i v = _mm_set1_epi32((int)load32(pixel));
+		for (; x + 4 <= width; x += 4)
+			_mm_storeu_si128((__m128i *)(dst + 4 * x), v);
+	}
+	else if (channels == 3)
+	{
+		// 16 pixels are exactly three vectors.
+		uint8_t pattern[48];
+		for (int i = 0; i < 16; i++)
+			memcpy(pattern + 3 * i, pixel, 3);
+		const __m128i a = _mm_loadu_si128((const __m128i *)pattern);
+		const __m128i b = _mm_loadu_si128((const __m128i *)(pattern + 16));
+		const __m128i c = _mm_loadu_si128((const __m128i *)(pattern + 32));
+		for (; x + 16 <= width; x += 16)
+		{
+			_mm_storeu_si128((__m128i *)(dst + 3 * x), a);
+			_mm_storeu_si128((__m128i *)(dst + 3 * x + 16), b);
+			_mm_storeu_si128((__m128i *)(dst + 3 * x + 32), c);
+		}
+	}
+	fill_row_scalar(dst + (size_t)x * channels, width - x, pixel, channels);
+}
+#endif
+
+void fill_row(uint8_t *dst, int width, const uint8_t *pixel, int channels)
+{
+	kernels().fill_row(dst, width, pixel, channels);
+}
+
+void blend_over_row_scalar(float *dst, int channels, const float *src, int width, float opacity)
+{
+	for (int i = 0; i < width; i++, dst += channels, src += 4)
+	{
+		float sa = src[3] * opacity;
+		float da = channels == 4 ? dst[3] : 1.0f;
+		float oa = sa + da * (1.0f - sa);
+		float ws = oa > 0.0f ? sa / oa : 0.0f;
+		for (int c = 0; c < 3; c++)
+			dst[c] = src[c] * ws + dst[c] * (1.0f - ws);
+		if (channels == 4)
+			dst[3] = oa;
+	}
+}
+
+#ifdef KERNELS_X86
+// One RGBA pixel per vector. The divide is masked rather than branched on, so
+// a fully transparent result still gets weight 0.
+void blend_over_row_sse2(float *dst, int channels, const float *src, int width, float opacity)
+{
+	if (channels != 4)
+	{
+		blend_over_row_scalar(dst, channels, src, width, opacity);
+		return;
+	}
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 op = _mm_set1_ps(opacity);
+	const __m128 alpha = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+	for (int i = 0; i < width; i++, dst += 4, src += 4)
+	{
+		__m128 s = _mm_loadu_ps(src);
+		__m128 d = _mm_loadu_ps(dst);
+		__m128 sa = _mm_mul_ps(_mm_shuffle_ps(s, s, 0xFF), op);
+		__m128 da = _mm_shuffle_ps(d, d, 0xFF);
+		__m128 oa = _mm_add_ps(sa, _mm_mul_ps(da, _mm_sub_ps(one, sa)));
+		__m128 ws = _mm_and_ps(_mm_cmpgt_ps(oa, zero), _mm_div_ps(sa, oa));
+		__m128 v = _mm_add_ps(_mm_mul_ps(s, ws), _mm_mul_ps(d, _mm_sub_ps(one, ws)));
+		_mm_storeu_ps(dst, _mm_or_ps(_mm_andnot_ps(alpha, v), _mm_and_ps(alpha, oa)));
+	}
+}
+#endif
+
+void blend_over_row(float *dst, int channels, const float *src, int width, float opacity)
+{
+	kernels().blend_over_row(dst, channels, src, width, opacity);
+}
+
+// Exact round(v / 255) for v up to 255 * 255.
+static inline uint32_t div255(uint32_t v)
+{
+	v += 128;
+	return (v + (v >> 8)) >> 8;
+}
+
+template <int C>
+static void blend_coverage_row_n(uint8_t *dst, const uint8_t *coverage, int width, const uint8_t *colour)
+{
+	for (int i = 0; i < width; i++, dst += C)
+	{
+		uint32_t sa = div255(coverage[i] * colour[3]);
+		if (!sa)
+			continue;
+		if (sa == 255)
+		{
+			memcpy(dst, colour, C);
+			continue;
+		}
+		uint32_t ws = sa;
+		if (C == 4)
+		{
+			// Straight alpha, as in blend_over_row.
+			uint32_t oa = sa + div255(dst[3] * (255 - sa));
+			ws = (sa * 255 + oa / 2) / oa;
+			dst[3] = oa;
+		}
+		for (int c = 0; c < (C == 4 ? 3 : C); c++)
+			dst[c] = div255(colour[c] * ws + dst[c] * (255 - ws));
+	}
+}
+
+void blend_coverage_row(uint8_t *dst, int channels, const uint8_t *coverage, int width, const uint8_t *colour)
+{
+	switch (channels)
+	{
+	case 1:
+		blend_coverage_row_n<1>(dst, coverage, width, colour);
+		break;
+	case 3:
+		blend_coverage_row_n<3>(dst, coverage, width, colour);
+		break;
+	case 4:
+		blend_coverage_row_n<4>(dst, coverage, width, colour);
+		break;
+	}
+}
+
+// Exact round(v / 257) for every 16-bit v without widening past 16 bits.
+static inline uint8_t narrow16(uint32_t v)
+{
+	return (uint8_t)((((v * 65281u) >> 16) + 128) >> 8);
+}
+
+void u8_to_u16_row(const uint8_t *src, uint16_t *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(v, v));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(v, v));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = (uint16_t)(src[i] * 257);
+}
+
+void u16_to_u8_row(const uint16_t *src, uint8_t *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i k = _mm_set1_epi16((short)65281);
+	const __m128i half = _mm_set1_epi16(128);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+		a = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(a, k), half), 8);
+		b = _mm_srli_epi16(_mm_add_epi16(_mm_mulhi_epu16(b, k), half), 8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = narrow16(src[i]);
+}
+
+void u8_to_f32_row(const uint8_t *src, float *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+		_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+		_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = src[i] * (1.0f / 255.0f);
+}
+
+#ifdef __SSE2__
+// Scales, rounds and clamps four floats to [0, max]. max(x, 0) comes first
+// with 0 as the second operand so a NaN lane becomes 0.
+static inline __m128i quantise4(const float *src, __m128 scale, __m128 max)
+{
+	__m128 v = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src), scale), _mm_set1_ps(0.5f));
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max);
+	return _mm_cvttps_epi32(v);
+}
+#endif
+
+void f32_to_u8_row(const float *src, uint8_t *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128 scale = _mm_set1_ps(255.0f);
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i a = _mm_packs_epi32(quantise4(src + i, scale, scale), quantise4(src + i + 4, scale, scale));
+		__m128i b = _mm_packs_epi32(quantise4(src + i + 8, scale, scale), quantise4(src + i + 12, scale, scale));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float v = std::min(std::max(0.0f, src[i] * 255.0f + 0.5f), 255.0f);
+		dst[i] = (uint8_t)(int)v;
+	}
+}
+
+void u16_to_f32_row(const uint16_t *src, float *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = src[i] * (1.0f / 65535.0f);
+}
+
+void f32_to_u16_row(const float *src, uint16_t *dst, int n)
+{
+	int i = 0;
+#ifdef __SSE2__
+	// SSE2 only packs with signed saturation, so pack v - 32768 and flip the
+	// sign bit back.
+	const __m128 scale = _mm_set1_ps(65535.0f);
+	const __m128i bias = _mm_set1_epi32(32768);
+	const __m128i flip = _mm_set1_epi16((short)0x8000);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128i a = _mm_sub_epi32(quantise4(src + i, scale, scale), bias);
+		__m128i b = _mm_sub_epi32(quantise4(src + i + 4, scale, scale), bias);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(_mm_packs_epi32(a, b), flip));
+	}
+#endif
+	for (; i < n; i++)
+	{
+		float v = std::min(std::max(0.0f, src[i] * 65535.0f + 0.5f), 65535.0f);
+		dst[i] = (uint16_t)(int)v;
+	}
+}
+
+// Averaging in the integer formats rounds half up; the 32-bit sums cannot
+// overflow for 16-bit samples.
+template <typename T>
+static inline T average4(T a, T b, T c, T d)
+{
+	return (T)(((uint32_t)a + b + c + d + 2) >> 2);
+}
+
+template <>
+inline float average4(float a, float b, float c, float d)
+{
+	return (a + b + c + d) * 0.25f;
+}
+
+template <typename T>
+static inline T average2(T a, T b)
+{
+	return (T)(((uint32_t)a + b + 1) >> 1);
+}
+
+template <>
+inline float average2(float a, float b)
+{
+	return (a + b) * 0.5f;
+}
+
+template <typename T, int C>
+static void downsample2x_row_n(const T *r0, const T *r1, T *dst, int width)
+{
+	int pairs = width >> 1;
+	for (int x = 0; x < pairs; x++)
+	{
+		for (int c = 0; c < C; c++)
+		{
+			int i = 2 * x * C + c;
+			dst[x * C + c] = average4(r0[i], r0[i + C], r1[i], r1[i + C]);
+		}
+	}
+	if (width & 1)
+	{
+		for (int c = 0; c < C; c++)
+		{
+			int i = (width - 1) * C + c;
+			dst[pairs * C + c] = average2(r0[i], r1[i]);
+		}
+	}
+}
+
+template <typename T>
+static void downsample2x_row_t(const T *r0, const T *r1, T *dst, int width, int channels)
+{
+	switch (channels)
+	{
+	case 1:
+		downsample2x_row_n<T, 1>(r0, r1, dst, width);
+		break;
+	case 3:
+		downsample2x_row_n<T, 3>(r0, r1, dst, width);
+		break;
+	case 4:
+		downsample2x_row_n<T, 4>(r0, r1, dst, width);
+		break;
+	default:
+		for (int x = 0; x < (width + 1) / 2; x++)
+		{
+			int x1 = 2 * x + 1 < width ? 2 * x + 1 : 2 * x;
+			for (int c = 0; c < channels; c++)
+				dst[x * channels + c] = average4(r0[2 * x * channels + c], r0[x1 * channels + c],
+				                                 r1[2 * x * channels + c], r1[x1 * channels + c]);
+		}
+	}
+}
+
+void downsample2x_row_scalar(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels)
+{
+	downsample2x_row_t(r0, r1, dst, width, channels);
+}
+
+#ifdef KERNELS_X86
+// Gray sums the even and odd bytes of each row as 16-bit lanes; RGBA widens
+// two pixel pairs and folds each pair's halves together.
+void downsample2x_row_sse2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels)
+{
+	int pairs = width >> 1;
+	int x = 0;
+	const __m128i two = _mm_set1_epi16(2);
+	const __m128i zero = _mm_setzero_si128();
+	if (channels == 1)
+	{
+		const __m128i even = _mm_set1_epi16(0x00FF);
+		for (; x + 16 <= pairs; x += 16)
+		{
+			__m128i out[2];
+			for (int h = 0; h < 2; h++)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i *)(r0 + 2 * x + 16 * h));
+				__m128i b = _mm_loadu_si128((const __m128i *)(r1 + 2 * x + 16 * h));
+				__m128i sum = _mm_add_epi16(_mm_and_si128(a, even), _mm_srli_epi16(a, 8));
+				sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_and_si128(b, even), _mm_srli_epi16(b, 8)));
+				out[h] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+			}
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_packus_epi16(out[0], out[1]));
+		}
+	}
+	else if (channels == 4)
+	{
+		for (; x + 2 <= pairs; x += 2)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(r0 + 8 * x));
+			__m128i b = _mm_loadu_si128((const __m128i *)(r1 + 8 * x));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+			hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+			__m128i sum = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(lo, hi), two), 2);
+			_mm_storel_epi64((__m128i *)(dst + 4 * x), _mm_packus_epi16(sum, zero));
+		}
+	}
+	size_t done = (size_t)x * channels;
+	downsample2x_row_scalar(r0 + 2 * done, r1 + 2 * done, dst + done, width - 2 * x, channels);
+}
+#endif
+
+void downsample2x_row(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels)
+{
+	kernels().downsample2x_row(r0, r1, dst, width, channels);
+}
+
+void downsample2x_row(const uint16_t *r0, const uint16_t *r1, uint16_t *dst, int width, int channels)
+{
+	downsample2x_row_t(r0, r1, dst, width, channels);
+}
+
+void downsample2x_row(const float *r0, const float *r1, float *dst, int width, int channels)
+{
+	downsample2x_row_t(r0, r1, dst, width, channels);
+}
+
+template <int C>
+static void apply_lut_row_n(uint8_t *row, int width, const uint8_t *lut)
+{
+	for (int x = 0; x < width; x++, row += C)
+	{
+		for (int c = 0; c < C; c++)
+			row[c] = lut[c * 256 + row[c]];
+	}
+}
+
+void apply_lut_row(uint8_t *row, int width, int channels, const uint8_t *lut)
+{
+	switch (channels)
+	{
+	case 1:
+	{
+		int x = 0;
+		for (; x + 4 <= width; x += 4)
+		{
+			uint8_t a = lut[row[x]];
+			uint8_t b = lut[row[x + 1]];
+			uint8_t c = lut[row[x + 2]];
+			uint8_t d = lut[row[x + 3]];
+			row[x] = a;
+			row[x + 1] = b;
+			row[x + 2] = c;
+			row[x + 3] = d;
+		}
+		for (; x < width; x++)
+			row[x] = lut[row[x]];
+		break;
+	}
+	case 3:
+		apply_lut_row_n<3>(row, width, lut);
+		break;
+	case 4:
+		apply_lut_row_n<4>(row, width, lut);
+		break;
+	default:
+		for (int x = 0; x < width; x++, row += channels)
+			for (int c = 0; c < channels; c++)
+				row[c] = lut[c * 256 + row[c]];
+	}
+}
+
+void apply_lut_swizzle_row(uint8_t *row, int width, int channels, const uint8_t *lut, const int *source)
+{
+	uint8_t in[4] = {0, 0, 0, 0xFF};
+	for (int x = 0; x < width; x++, row += channels)
+	{
+		for (int c = 0; c < channels; c++)
+			in[c] = row[c];
+		for (int c = 0; c < channels; c++)
+			row[c] = lut[c * 256 + in[source[c]]];
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <stdint.h>
+
+// Row kernels shared by the BMP codec and the image operations. The codec
+// kernels convert a single scanline between the on-disk layout (BGR order,
+// packed or indexed) and the in-memory layout of Image (RGB order, one byte
+// per channel). Palette expansion, channel swaps, fill, blend and the 8-bit
+// downsample go through the table in Dispatch.h.
+
+struct BitFields
+{
+	uint32_t mask[4];			// r, g, b, a
+	int shift[4];
+	int bits[4];
+	uint8_t scale[4][256];	// Expands a channel of <= 8 bits to 8 bits
+
+	BitFields(uint32_t r, uint32_t g, uint32_t b, uint32_t a);
+};
+
+void unpack_pal1_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_pal4_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_pal8_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_bgr24_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_bgra32_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_bgrx32_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_rgb565_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_rgb555_row(const uint8_t *src, uint8_t *dst, int width);
+void unpack_bitfields16_row(const uint8_t *src, uint8_t *dst, int width, const BitFields &bf, int channels);
+void unpack_bitfields32_row(const uint8_t *src, uint8_t *dst, int width, const BitFields &bf, int channels);
+
+void expand_palette_row(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette);
+void pack_bgr24_row(const uint8_t *src, uint8_t *dst, int width);
+void pack_bgra32_row(const uint8_t *src, uint8_t *dst, int width);
+
+// Writes width copies of a pixel of the given number of 8-bit channels.
+void fill_row(uint8_t *dst, int width, const uint8_t *pixel, int channels);
+
+// Source over for a row of width RGBA float pixels onto dst, which has 3 or
+// 4 channels. Source alpha is scaled by opacity; dst alpha, if any, becomes
+// the combined coverage.
+void blend_over_row(float *dst, int channels, const float *src, int width, float opacity);
+
+// Source over of a single RGBA colour onto a row of width 8-bit pixels of 1,
+// 3 or 4 channels, with each pixel's source alpha scaled by its coverage
+// byte. Gray pixels take the colour's first component. Pixels with no
+// coverage are not touched.
+void blend_coverage_row(uint8_t *dst, int channels, const uint8_t *coverage, int width, const uint8_t *colour);
+
+// 2x2 box filter over two source rows of the given width. An odd last
+// column is averaged with itself.
+void downsample2x_row(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels);
+void downsample2x_row(const uint16_t *r0, const uint16_t *r1, uint16_t *dst, int width, int channels);
+void downsample2x_row(const float *r0, const float *r1, float *dst, int width, int channels);
+
+// Sample depth conversions between 8-bit, 16-bit and float channels, over n
+// samples. Floats are normalised to [0, 1]; narrowing rounds to nearest and
+// clamps, and NaN narrows to 0. SSE2 is used where available.
+void u8_to_u16_row(const uint8_t *src, uint16_t *dst, int n);
+void u16_to_u8_row(const uint16_t *src, uint8_t *dst, int n);
+void u8_to_f32_row(const uint8_t *src, float *dst, int n);
+void f32_to_u8_row(const float *src, uint8_t *dst, int n);
+void u16_to_f32_row(const uint16_t *src, float *dst, int n);
+void f32_to_u16_row(const float *src, uint16_t *dst, int n);
+
+// Maps every channel of a row through its own 256 entry table; lut holds
+// channels tables back to back.
+void apply_lut_row(uint8_t *row, int width, int channels, const uint8_t *lut);
+
+// As apply_lut_row, but output channel c reads input channel source[c].
+// A missing alpha channel reads as 255.
+void apply_lut_swizzle_row(uint8_t *row, int width, int channels, const uint8_t *lut, const int *source);
+
+#endif //__KERNELS_H__
@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "KernelVariants.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+// FMA is left out so the float blend rounds exactly as the scalar one does.
+#define AVX2 __attribute__((target("avx2")))
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// Gathers eight palette entries, drops the fourth byte of each within its
+// lane and closes the gap between the lanes, leaving 24 bytes at the bottom.
+// The 32-byte store needs 11 pixels of room.
+AVX2 void expand_palette_row_avx2(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette)
+{
+	const __m256i order = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+	                                       2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i compact = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+	int x = 0;
+	for (; x + 11 <= width; x += 8)
+	{
+		__m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + x)));
+		__m256i v = _mm256_i32gather_epi32((const int *)palette, index, 4);
+		v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, order), compact);
+		_mm256_storeu_si256((__m256i *)(dst + 3 * x), v);
+	}
+	expand_palette_row_scalar(src + x, dst + 3 * x, width - x, palette);
+}
+
+AVX2 void swap_rb32_row_avx2(const uint8_t *src, uint8_t *dst, int width)
+{
+	const __m256i order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+	                                       2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	int x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * x));
+		_mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_shuffle_epi8(v, order));
+	}
+	swap_rb32_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+
+AVX2 void fill_row_avx2(uint8_t *dst, int width, const uint8_t *pixel, int channels)
+{
+	int x = 0;
+	if (channels == 4)
+	{
+		const __m256i v = _mm256_set1_epi32((int)load32(pixel));
+		for (; x + 8 <= width; x += 8)
+			_mm256_storeu_si256((__m256i *)(dst + 4 * x), v);
+	}
+	else if (channels == 3)
+	{
+		// 32 pixels are exactly three vectors.
+		uint8_t pattern[96];
+		for (int i = 0; i < 32; i++)
+			memcpy(pattern + 3 * i, pixel, 3);
+		const __m256i a = _mm256_loadu_si256((const __m256i *)pattern);
+		const __m256i b = _mm256_loadu_si256((const __m256i *)(pattern + 32));
+		const __m256i c = _mm256_loadu_si256((const __m256i *)(pattern + 64));
+		for (; x + 32 <= width; x += 32)
+		{
+			_mm256_storeu_si256((__m256i *)(dst + 3 * x), a);
+			_mm256_storeu_si256((__m256i *)(dst + 3 * x + 32), b);
+			_mm256_storeu_si256((__m256i *)(dst + 3 * x + 64), c);
+		}
+	}
+	fill_row_scalar(dst + (size_t)x * channels, width - x, pixel, channels);
+}
+
+// Two RGBA pixels per vector; as blend_over_row_sse2 otherwise.
+AVX2 void blend_over_row_avx2(float *dst, int channels, const float *src, int width, float opacity)
+{
+	if (channels != 4)
+	{
+		blend_over_row_scalar(dst, channels, src, width, opacity);
+		return;
+	}
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 op = _mm256_set1_ps(opacity);
+	int x = 0;
+	for (; x + 2 <= width; x += 2, dst += 8, src += 8)
+	{
+		__m256 s = _mm256_loadu_ps(src);
+		__m256 d = _mm256_loadu_ps(dst);
+		__m256 sa = _mm256_mul_ps(_mm256_shuffle_ps(s, s, 0xFF), op);
+		__m256 da = _mm256_shuffle_ps(d, d, 0xFF);
+		__m256 oa = _mm256_add_ps(sa, _mm256_mul_ps(da, _mm256_sub_ps(one, sa)));
+		__m256 ws = _mm256_and_ps(_mm256_cmp_ps(oa, zero, _CMP_GT_OQ), _mm256_div_ps(sa, oa));
+		__m256 v = _mm256_add_ps(_mm256_mul_ps(s, ws), _mm256_mul_ps(d, _mm256_sub_ps(one, ws)));
+		_mm256_storeu_ps(dst, _mm256_blend_ps(v, oa, 0x88));
+	}
+	blend_over_row_scalar(dst, channels, src, width - x, opacity);
+}
+
+// As downsample2x_row_sse2 on twice the width; packus works within 128-bit
+// lanes, so the quadwords are put back in order before the store.
+AVX2 void downsample2x_row_avx2(const uint8_t *r0, const uint8_t *r1, uint8_t *dst, int width, int channels)
+{
+	int pairs = width >> 1;
+	int x = 0;
+	const __m256i two = _mm256_set1_epi16(2);
+	const __m256i zero = _mm256_setzero_si256();
+	if (channels == 1)
+	{
+		const __m256i even = _mm256_set1_epi16(0x00FF);
+		for (; x + 32 <= pairs; x += 32)
+		{
+			__m256i out[2];
+			for (int h = 0; h < 2; h++)
+			{
+				__m256i a = _mm256_loadu_si256((const __m256i *)(r0 + 2 * x + 32 * h));
+				__m256i b = _mm256_loadu_si256((const __m256i *)(r1 + 2 * x + 32 * h));
+				__m256i sum = _mm256_add_epi16(_mm256_and_si256(a, even), _mm256_srli_epi16(a, 8));
+				sum = _mm256_add_epi16(sum, _mm256_add_epi16(_mm256_and_si256(b, even), _mm256_srli_epi16(b, 8)));
+				out[h] = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+			}
+			__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(out[0], out[1]), 0xD8);
+			_mm256_storeu_si256((__m256i *)(dst + x), v);
+		}
+	}
+	else if (channels == 4)
+	{
+		for (; x + 4 <= pairs; x += 4)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i *)(r0 + 8 * x));
+			__m256i b = _mm256_loadu_si256((const __m256i *)(r1 + 8 * x));
+			__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+			__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+			lo = _mm256_add_epi16(lo, _mm256_srli_si256(lo, 8));
+			hi = _mm256_add_epi16(hi, _mm256_srli_si256(hi, 8));
+			__m256i sum = _mm256_srli_epi16(_mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), two), 2);
+			__m256i v = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, zero), 0xD8);
+			_mm_storeu_si128((__m128i *)(dst + 4 * x), _mm256_castsi256_si128(v));
+		}
+	}
+	size_t done = (size_t)x * channels;
+	downsample2x_row_scalar(r0 + 2 * done, r1 + 2 * done, dst + done, width - 2 * x, channels);
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "KernelVariants.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+// GCC 12's AVX-512 headers trip these on their own undefined placeholders.
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// AVX-512BW is needed for the byte shuffles. Masked stores take care of the
+// row tails that the narrower levels hand to the scalar code.
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// As expand_palette_row_avx2 with sixteen pixels; the 48 bytes are written
+// with a masked store, so no room beyond the row is needed.
+AVX512 void expand_palette_row_avx512(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette)
+{
+	const __m512i order = _mm512_broadcast_i32x4(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+	const __m512i compact = _mm512_setr_epi32(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, 15, 15, 15, 15);
+	int x = 0;
+	for (; x + 16 <= width; x += 16)
+	{
+		__m512i index = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)(src + x)));
+		__m512i v = _mm512_i32gather_epi32(index, (const void *)palette, 4);
+		v = _mm512_permutexvar_epi32(compact, _mm512_shuffle_epi8(v, order));
+		_mm512_mask_storeu_epi32(dst + 3 * x, 0x0FFF, v);
+	}
+	expand_palette_row_scalar(src + x, dst + 3 * x, width - x, palette);
+}
+
+AVX512 void swap_rb32_row_avx512(const uint8_t *src, uint8_t *dst, int width)
+{
+	const __m512i order = _mm512_broadcast_i32x4(_mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15));
+	for (int x = 0; x < width; x += 16)
+	{
+		__mmask16 m = width - x >= 16 ? 0xFFFF : (__mmask16)((1u << (width - x)) - 1);
+		__m512i v = _mm512_maskz_loadu_epi32(m, src + 4 * x);
+		_mm512_mask_storeu_epi32(dst + 4 * x, m, _mm512_shuffle_epi8(v, order));
+	}
+}
+
+AVX512 void fill_row_avx512(uint8_t *dst, int width, const uint8_t *pixel, int channels)
+{
+	if (channels != 4)
+	{
+		fill_row_avx2(dst, width, pixel, channels);
+		return;
+	}
+	const __m512i v = _mm512_set1_epi32((int)load32(pixel));
+	for (int x = 0; x < width; x += 16)
+	{
+		__mmask16 m = width - x >= 16 ? 0xFFFF : (__mmask16)((1u << (width - x)) - 1);
+		_mm512_mask_storeu_epi32(dst + 4 * x, m, v);
+	}
+}
+
+// Four RGBA pixels per vector; as blend_over_row_sse2 otherwise. AVX-512F
+// brings FMA with it, so the compiler may fuse the multiply-adds and the
+// result can differ from the scalar blend in the last bit.
+AVX512 void blend_over_row_avx512(float *dst, int channels, const float *src, int width, float opacity)
+{
+	if (channels != 4)
+	{
+		blend_over_row_scalar(dst, channels, src, width, opacity);
+		return;
+	}
+	const __m512 one = _mm512_set1_ps(1.0f);
+	const __m512 zero = _mm512_setzero_ps();
+	const __m512 op = _mm512_set1_ps(opacity);
+	for (int x = 0; x < width; x += 4, dst += 16, src += 16)
+	{
+		__mmask16 m = width - x >= 4 ? 0xFFFF : (__mmask16)((1u << (4 * (width - x))) - 1);
+		__m512 s = _mm512_maskz_loadu_ps(m, src);
+		__m512 d = _mm512_maskz_loadu_ps(m, dst);
+		__m512 sa = _mm512_mul_ps(_mm512_shuffle_ps(s, s, 0xFF), op);
+		__m512 da = _mm512_shuffle_ps(d, d, 0xFF);
+		__m512 oa = _mm512_add_ps(sa, _mm512_mul_ps(da, _mm512_sub_ps(one, sa)));
+		__m512 ws = _mm512_maskz_div_ps(_mm512_cmp_ps_mask(oa, zero, _CMP_GT_OQ), sa, oa);
+		__m512 v = _mm512_add_ps(_mm512_mul_ps(s, ws), _mm512_mul_ps(d, _mm512_sub_ps(one, ws)));
+		_mm512_mask_storeu_ps(dst, m, _mm512_mask_blend_ps(0x8888, v, oa));
+	}
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "KernelVariants.h"
+
+#ifdef KERNELS_X86
+#include <immintrin.h>
+
+// The SSE4.2 level mostly buys pshufb, which does a whole channel swap in
+// one instruction.
+#define SSE42 __attribute__((target("sse4.2")))
+
+static inline uint32_t load32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// Stores 16 bytes per 6 pixels and lets the next iteration overwrite the
+// spare ones, so it stops while 6 pixels of room remain.
+SSE42 void expand_palette_row_sse42(const uint8_t *src, uint8_t *dst, int width, const uint8_t *palette)
+{
+	const __m128i order = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	int x = 0;
+	for (; x + 6 <= width; x += 4)
+	{
+		__m128i v = _mm_setr_epi32((int)load32(palette + 4 * src[x]), (int)load32(palette + 4 * src[x + 1]),
+		                           (int)load32(palette + 4 * src[x + 2]), (int)load32(palette + 4 * src[x + 3]));
+		_mm_storeu_si128((__m128i *)(dst + 3 * x), _mm_shuffle_epi8(v, order));
+	}
+	expand_palette_row_scalar(src + x, dst + 3 * x, width - x, palette);
+}
+
+// Five pixels per vector; the sixteenth byte is copied through unchanged and
+// rewritten by the next iteration.
+SSE42 void swap_rb24_row_sse42(const uint8_t *src, uint8_t *dst, int width)
+{
+	const __m128i order = _mm_setr_epi8(2, 1, 0, 5, 4, 3, 8, 7, 6, 11, 10, 9, 14, 13, 12, 15);
+	int x = 0;
+	for (; 3 * x + 16 <= 3 * width; x += 5)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 3 * x));
+		_mm_storeu_si128((__m128i *)(dst + 3 * x), _mm_shuffle_epi8(v, order));
+	}
+	swap_rb24_row_scalar(src + 3 * x, dst + 3 * x, width - x);
+}
+
+SSE42 void swap_rb32_row_sse42(const uint8_t *src, uint8_t *dst, int width)
+{
+	const __m128i order = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	int x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * x));
+		_mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_shuffle_epi8(v, order));
+	}
+	swap_rb32_row_scalar(src + 4 * x, dst + 4 * x, width - x);
+}
+
+#endif
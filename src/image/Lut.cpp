@@ -0,0 +1,149 @@
+#include <math.h>
+#include <string.h>
+
+#include "Lut.h"
+#include "Kernels.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+static inline uint8_t clamp_byte(double v)
+{
+	return v <= 0.0 ? 0 : (v >= 255.0 ? 255 : (uint8_t)(v + 0.5));
+}
+
+ColourLut::ColourLut()
+{
+	for (int c = 0; c < RGBAQUAD; c++)
+	{
+		source[c] = c;
+		for (int v = 0; v < NUM_COLORS; v++)
+			table[c][v] = v;
+	}
+}
+
+bool ColourLut::is_identity_order()
+{
+	for (int c = 0; c < RGBAQUAD; c++)
+		if (source[c] != c)
+			return false;
+	return true;
+}
+
+bool ColourLut::is_gray()
+{
+	return source[0] == 0 && source[1] == 1 && source[2] == 2 &&
+	       memcmp(table[0], table[1], NUM_COLORS) == 0 &&
+	       memcmp(table[0], table[2], NUM_COLORS) == 0;
+}
+
+ColourLut &ColourLut::map(const uint8_t *lut, int mask)
+{
+	for (int c = 0; c < RGBAQUAD; c++)
+		if (mask & (1 << c))
+			for (int v = 0; v < NUM_COLORS; v++)
+				table[c][v] = lut[table[c][v]];
+	return *this;
+}
+
+ColourLut &ColourLut::gamma(double g, int mask)
+{
+	uint8_t lut[NUM_COLORS];
+	for (int v = 0; v < NUM_COLORS; v++)
+		lut[v] = clamp_byte(255.0 * pow(v / 255.0, 1.0 / g));
+	return map(lut, mask);
+}
+
+ColourLut &ColourLut::brightness_contrast(int brightness, double contrast, int mask)
+{
+	uint8_t lut[NUM_COLORS];
+	for (int v = 0; v < NUM_COLORS; v++)
+		lut[v] = clamp_byte((v - 128) * contrast + 128 + brightness);
+	return map(lut, mask);
+}
+
+ColourLut &ColourLut::invert(int mask)
+{
+	uint8_t lut[NUM_COLORS];
+	for (int v = 0; v < NUM_COLORS; v++)
+		lut[v] = 255 - v;
+	return map(lut, mask);
+}
+
+ColourLut &ColourLut::threshold(uint8_t t, int mask)
+{
+	uint8_t lut[NUM_COLORS];
+	for (int v = 0; v < NUM_COLORS; v++)
+		lut[v] = v >= t ? 255 : 0;
+	return map(lut, mask);
+}
+
+ColourLut &ColourLut::swap_channels(int a, int b)
+{
+	uint8_t tmp[NUM_COLORS];
+	memcpy(tmp, table[a], NUM_COLORS);
+	memcpy(table[a], table[b], NUM_COLORS);
+	memcpy(table[b], tmp, NUM_COLORS);
+	std::swap(source[a], source[b]);
+	return *this;
+}
+
+ColourLut &ColourLut::then(const ColourLut &next)
+{
+	ColourLut prev(*this);
+	for (int c = 0; c < RGBAQUAD; c++)
+	{
+		int s = next.source[c];
+		source[c] = prev.source[s];
+		for (int v = 0; v < NUM_COLORS; v++)
+			table[c][v] = next.table[c][prev.table[s][v]];
+	}
+	return *this;
+}
+
+bool ColourLut::apply(Image &img)
+{
+	if (!img.buffer())
+		return false;
+	PROFILE_SCOPE(OP_LUT);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+
+	int w = img.get_width();
+	int channels = img.get_bytespp();
+	size_t stride = img.get_stride();
+	uint8_t *data = img.buffer();
+
+	if (channels == 1 && img.get_palette_size() > 0 && !(img.is_grayscale() && is_gray()))
+	{
+		// A view's palette is its own copy; changing it would not reach the parent.
+		if (img.is_view())
+			return false;
+		uint8_t *pal = img.palette_buffer();
+		for (int i = 0; i < img.get_palette_size() / RGBAQUAD; i++)
+		{
+			uint8_t *entry = pal + i * RGBAQUAD;
+			uint8_t in[RGBAQUAD] = {entry[2], entry[1], entry[0], 0xFF};
+			entry[2] = table[0][in[source[0]]];
+			entry[1] = table[1][in[source[1]]];
+			entry[0] = table[2][in[source[2]]];
+		}
+		return true;
+	}
+
+	if (channels != Image::GRAYSCALE && channels != Image::RGB && channels != Image::RGBA)
+		return false;
+
+	bool identity = is_identity_order();
+	const uint8_t *lut = &table[0][0];
+	const int *order = source;
+	parallel_bands(img.get_height(), [=](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			uint8_t *row = data + y * stride;
+			if (identity)
+				apply_lut_row(row, w, channels, lut);
+			else
+				apply_lut_swizzle_row(row, w, channels, lut, order);
+		}
+	});
+	return true;
+}
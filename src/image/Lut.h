@@ -0,0 +1,47 @@
+#ifndef __LUT_H__
+#define __LUT_H__
+
+#include "Image.h"
+
+enum ChannelMask
+{
+	CHANNEL_R = 1,
+	CHANNEL_G = 2,
+	CHANNEL_B = 4,
+	CHANNEL_A = 8,
+	CHANNELS_RGB = CHANNEL_R | CHANNEL_G | CHANNEL_B,
+	CHANNELS_ALL = CHANNELS_RGB | CHANNEL_A
+};
+
+// A chain of point operations compiled into one 256 entry table per output
+// channel plus a channel permutation, so that any number of operations costs
+// a single pass over the image. Each operation is composed onto the tables
+// as it is added:
+//
+//   ColourLut().gamma(2.2).brightness_contrast(10, 1.2).invert().apply(img);
+//
+// Grayscale images are remapped in place while the chain keeps them gray.
+// Other indexed images have their palette rewritten instead of their pixels.
+class ColourLut
+{
+	uint8_t table[RGBAQUAD][NUM_COLORS];
+	int source[RGBAQUAD];		// Input channel feeding each output channel
+
+	bool is_identity_order();
+	bool is_gray();
+
+public:
+	ColourLut();
+
+	ColourLut &map(const uint8_t *lut, int mask = CHANNELS_RGB);
+	ColourLut &gamma(double g, int mask = CHANNELS_RGB);		// out = 255 * (in / 255)^(1 / g)
+	ColourLut &brightness_contrast(int brightness, double contrast, int mask = CHANNELS_RGB);
+	ColourLut &invert(int mask = CHANNELS_RGB);
+	ColourLut &threshold(uint8_t t, int mask = CHANNELS_RGB);
+	ColourLut &swap_channels(int a, int b);
+	ColourLut &then(const ColourLut &next);
+
+	bool apply(Image &img);
+};
+
+#endif //__LUT_H__
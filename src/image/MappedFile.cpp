@@ -0,0 +1,68 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile() : data(NULL), size(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char *filename)
+{
+	close();
+	int fd = -1;
+	try
+	{
+		fd = ::open(filename, O_RDONLY);
+		if (fd < 0)
+			throw "Could not open file";
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+			throw "Not a regular file";
+		if (st.st_size <= 0)
+			throw "Could not read data from file";
+
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED)
+			throw "Could not map file";
+		::close(fd);
+
+		data = (uint8_t *)p;
+		size = st.st_size;
+		return true;
+	}
+	catch (const char* msg)
+	{
+		if (fd >= 0)
+			::close(fd);
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
+
+void MappedFile::close()
+{
+	if (data)
+		munmap(data, size);
+	data = NULL;
+	size = 0;
+}
+
+const uint8_t *MappedFile::bytes() const
+{
+	return data;
+}
+
+size_t MappedFile::length() const
+{
+	return size;
+}
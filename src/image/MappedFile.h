@@ -0,0 +1,29 @@
+#ifndef __MAPPED_FILE_H__
+#define __MAPPED_FILE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read-only memory mapping of a whole file. The pages are only read in when
+// touched, so comparing or decoding straight from the mapping avoids a copy
+// through a read buffer.
+class MappedFile
+{
+	uint8_t *data;
+	size_t size;
+
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+public:
+	MappedFile();
+	~MappedFile();
+
+	bool open(const char *filename);
+	void close();
+
+	const uint8_t *bytes() const;
+	size_t length() const;
+};
+
+#endif //__MAPPED_FILE_H__
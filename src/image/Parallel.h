@@ -0,0 +1,39 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#define MIN_BAND_ROWS       16
+
+// Splits the rows [0, n) into one contiguous band per hardware thread and
+// calls fn(begin, end) for each band. Small jobs run on the calling thread.
+template <typename F>
+void parallel_bands(int n, F fn, int min_band = MIN_BAND_ROWS)
+{
+	int threads = std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	int bands = std::min(threads, (n + min_band - 1) / min_band);
+	if (bands <= 1)
+	{
+		if (n > 0)
+			fn(0, n);
+		return;
+	}
+
+	int step = (n + bands - 1) / bands;
+	std::vector<std::thread> pool;
+	for (int begin = step; begin < n; begin += step)
+	{
+		pool.push_back(std::thread(fn, begin, std::min(n, begin + step)));
+	}
+	fn(0, step);
+	for (size_t i = 0; i < pool.size(); i++)
+	{
+		pool[i].join();
+	}
+}
+
+#endif //__PARALLEL_H__
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "Profile.h"
+
+static const char *OP_NAMES[OP_COUNT] = {
+	"read_bmp",
+	"read_bmp_region",
+	"decode_bmp",
+	"write_bmp",
+	"convert",
+	"flip",
+	"scale",
+	"draw_line",
+	"draw_triangle",
+	"draw_image",
+	"filter",
+	"histogram",
+	"lut",
+	"quantize",
+	"pyramid",
+	"composite",
+	"compare",
+	"flood_fill",
+	"label",
+	"morphology",
+	"distance"
+};
+
+struct TraceEvent
+{
+	ProfileOp op;
+	int64_t start_us;
+	int64_t duration_us;
+};
+
+// Single writer per field, so relaxed load/store pairs are enough and no
+// read-modify-write is needed on the hot path.
+struct AtomicCounters
+{
+	std::atomic<uint64_t> calls;
+	std::atomic<uint64_t> pixels;
+	std::atomic<uint64_t> bytes_read;
+	std::atomic<uint64_t> bytes_written;
+	std::atomic<uint64_t> nanos;
+};
+
+struct ThreadProfile
+{
+	int tid;
+	AtomicCounters ops[OP_COUNT];
+	std::mutex trace_lock;
+	std::vector<TraceEvent> trace;
+};
+
+struct RetiredEvent
+{
+	int tid;
+	TraceEvent event;
+};
+
+// Profiles of running threads, plus what exited threads left behind.
+static std::mutex registry_lock;
+static std::vector<ThreadProfile *> registry;
+static OpCounters retired[OP_COUNT];
+static std::vector<RetiredEvent> retired_trace;
+static int next_tid = 1;
+static std::atomic<bool> tracing(false);
+static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+static inline void bump(std::atomic<uint64_t> &counter, uint64_t n)
+{
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Folds an exiting thread's counters and trace into the retired totals, so
+// that short-lived threads such as those of parallel_bands cost nothing once
+// they are gone.
+static void retire(ThreadProfile *profile)
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	for (int i = 0; i < OP_COUNT; i++)
+	{
+		const AtomicCounters &c = profile->ops[i];
+		OpCounters &r = retired[i];
+		r.calls += c.calls.load(std::memory_order_relaxed);
+		r.pixels += c.pixels.load(std::memory_order_relaxed);
+		r.bytes_read += c.bytes_read.load(std::memory_order_relaxed);
+		r.bytes_written += c.bytes_written.load(std::memory_order_relaxed);
+		r.nanos += c.nanos.load(std::memory_order_relaxed);
+	}
+	for (size_t i = 0; i < profile->trace.size(); i++)
+	{
+		RetiredEvent e;
+		e.tid = profile->tid;
+		e.event = profile->trace[i];
+		retired_trace.push_back(e);
+	}
+	registry.erase(std::find(registry.begin(), registry.end(), profile));
+	delete profile;
+}
+
+struct ThreadProfileOwner
+{
+	ThreadProfile *profile;
+
+	ThreadProfileOwner() : profile(NULL)
+	{
+	}
+
+	~ThreadProfileOwner()
+	{
+		if (profile)
+			retire(profile);
+	}
+};
+
+static ThreadProfile &thread_profile()
+{
+	static thread_local ThreadProfileOwner owner;
+	if (!owner.profile)
+	{
+		ThreadProfile *profile = new ThreadProfile();
+		for (int i = 0; i < OP_COUNT; i++)
+		{
+			AtomicCounters &c = profile->ops[i];
+			c.calls = c.pixels = c.bytes_read = c.bytes_written = c.nanos = 0;
+		}
+		std::lock_guard<std::mutex> guard(registry_lock);
+		profile->tid = next_tid++;
+		registry.push_back(profile);
+		owner.profile = profile;
+	}
+	return *owner.profile;
+}
+
+const char *profile_op_name(ProfileOp op)
+{
+	return op < OP_COUNT ? OP_NAMES[op] : "unknown";
+}
+
+ProfileSnapshot profile_snapshot()
+{
+	ProfileSnapshot snapshot;
+	memset(&snapshot, 0, sizeof(snapshot));
+
+	std::lock_guard<std::mutex> guard(registry_lock);
+	memcpy(snapshot.ops, retired, sizeof(retired));
+	for (size_t t = 0; t < registry.size(); t++)
+	{
+		for (int i = 0; i < OP_COUNT; i++)
+		{
+			const AtomicCounters &c = registry[t]->ops[i];
+			OpCounters &s = snapshot.ops[i];
+			s.calls += c.calls.load(std::memory_order_relaxed);
+			s.pixels += c.pixels.load(std::memory_order_relaxed);
+			s.bytes_read += c.bytes_read.load(std::memory_order_relaxed);
+			s.bytes_written += c.bytes_written.load(std::memory_order_relaxed);
+			s.nanos += c.nanos.load(std::memory_order_relaxed);
+		}
+	}
+	return snapshot;
+}
+
+// Resetting races with threads that are still counting; call it while no
+// operations are running.
+void profile_reset()
+{
+	std::lock_guard<std::mutex> guard(registry_lock);
+	memset(retired, 0, sizeof(retired));
+	retired_trace.clear();
+	for (size_t t = 0; t < registry.size(); t++)
+	{
+		for (int i = 0; i < OP_COUNT; i++)
+		{
+			AtomicCounters &c = registry[t]->ops[i];
+			c.calls = c.pixels = c.bytes_read = c.bytes_written = c.nanos = 0;
+		}
+		std::lock_guard<std::mutex> trace_guard(registry[t]->trace_lock);
+		registry[t]->trace.clear();
+	}
+}
+
+void profile_enable_trace(bool enabled)
+{
+	tracing.store(enabled);
+}
+
+bool profile_dump_trace(const char *filename)
+{
+	FILE *fp = fopen(filename, "w");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "{\"traceEvents\":[");
+	bool first = true;
+	std::lock_guard<std::mutex> guard(registry_lock);
+	for (size_t i = 0; i < retired_trace.size(); i++)
+	{
+		const TraceEvent &e = retired_trace[i].event;
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+		        first ? "" : ",", OP_NAMES[e.op],
+		        (long long)e.start_us, (long long)e.duration_us, retired_trace[i].tid);
+		first = false;
+	}
+	for (size_t t = 0; t < registry.size(); t++)
+	{
+		std::lock_guard<std::mutex> trace_guard(registry[t]->trace_lock);
+		const std::vector<TraceEvent> &trace = registry[t]->trace;
+		for (size_t i = 0; i < trace.size(); i++)
+		{
+			fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":1,\"tid\":%d}",
+			        first ? "" : ",", OP_NAMES[trace[i].op],
+			        (long long)trace[i].start_us, (long long)trace[i].duration_us, registry[t]->tid);
+			first = false;
+		}
+	}
+	fprintf(fp, "\n]}\n");
+	return fclose(fp) == 0;
+}
+
+ProfileScope::ProfileScope(ProfileOp op) :
+op(op), start(std::chrono::steady_clock::now()), pixels(0), bytes_read(0), bytes_written(0)
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	uint64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+	ThreadProfile &profile = thread_profile();
+	AtomicCounters &c = profile.ops[op];
+	bump(c.calls, 1);
+	bump(c.pixels, pixels);
+	bump(c.bytes_read, bytes_read);
+	bump(c.bytes_written, bytes_written);
+	bump(c.nanos, nanos);
+
+	if (tracing.load(std::memory_order_relaxed))
+	{
+		TraceEvent event;
+		event.op = op;
+		event.start_us = std::chrono::duration_cast<std::chrono::microseconds>(start - epoch).count();
+		event.duration_us = nanos / 1000;
+		std::lock_guard<std::mutex> guard(profile.trace_lock);
+		profile.trace.push_back(event);
+	}
+}
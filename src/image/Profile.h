@@ -0,0 +1,90 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+#include <chrono>
+
+// Per-operation counters for the hot paths of the image and sketch
+// libraries. Counting is compiled in only when IMAGE_PROFILE is defined
+// (bazel build --define profile=true); otherwise the PROFILE_* macros expand
+// to nothing and cost nothing.
+//
+// Counters live in thread-local storage and are only ever written by their
+// own thread. profile_snapshot() sums them over every thread that has run an
+// operation.
+
+enum ProfileOp
+{
+	OP_READ_BMP,
+	OP_READ_BMP_REGION,
+	OP_DECODE_BMP,
+	OP_WRITE_BMP,
+	OP_CONVERT,
+	OP_FLIP,
+	OP_SCALE,
+	OP_DRAW_LINE,
+	OP_DRAW_TRIANGLE,
+	OP_DRAW_IMAGE,
+	OP_FILTER,
+	OP_HISTOGRAM,
+	OP_LUT,
+	OP_QUANTIZE,
+	OP_PYRAMID,
+	OP_COMPOSITE,
+	OP_COMPARE,
+	OP_FLOOD_FILL,
+	OP_LABEL,
+	OP_MORPHOLOGY,
+	OP_DISTANCE,
+	OP_COUNT
+};
+
+struct OpCounters
+{
+	uint64_t calls;
+	uint64_t pixels;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t nanos;
+};
+
+struct ProfileSnapshot
+{
+	OpCounters ops[OP_COUNT];
+};
+
+const char *profile_op_name(ProfileOp op);
+ProfileSnapshot profile_snapshot();
+void profile_reset();
+
+// Trace events are only collected while tracing is enabled.
+void profile_enable_trace(bool enabled);
+bool profile_dump_trace(const char *filename);
+
+class ProfileScope
+{
+	ProfileOp op;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	uint64_t pixels;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+
+	ProfileScope(ProfileOp op);
+	~ProfileScope();
+};
+
+#ifdef IMAGE_PROFILE
+#define PROFILE_SCOPE(op)           ProfileScope profile_scope_(op)
+#define PROFILE_PIXELS(n)           (profile_scope_.pixels += (n))
+#define PROFILE_BYTES_READ(n)       (profile_scope_.bytes_read += (n))
+#define PROFILE_BYTES_WRITTEN(n)    (profile_scope_.bytes_written += (n))
+#else
+#define PROFILE_SCOPE(op)
+#define PROFILE_PIXELS(n)
+#define PROFILE_BYTES_READ(n)
+#define PROFILE_BYTES_WRITTEN(n)
+#endif
+
+#endif //__PROFILE_H__
@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <memory>
+#include <vector>
+
+#include "Pyramid.h"
+#include "Kernels.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+void downsample2x(const Image &src, Image &dst)
+{
+	int w = src.get_width();
+	int h = src.get_height();
+	int bpp = src.get_bytespp();
+	dst = Image((h + 1) / 2, (w + 1) / 2, bpp);
+
+	const uint8_t *in = src.buffer();
+	uint8_t *out = dst.buffer();
+	size_t in_line = src.get_stride();
+	size_t out_line = (size_t)dst.get_width() * bpp;
+
+	parallel_bands(dst.get_height(), [=](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const uint8_t *r0 = in + 2 * y * in_line;
+			const uint8_t *r1 = 2 * y + 1 < h ? r0 + in_line : r0;
+			downsample2x_row(r0, r1, out + y * out_line, w, bpp);
+		}
+	});
+}
+
+template <typename T>
+void downsample2x(const ImageT<T> &src, ImageT<T> &dst)
+{
+	int w = src.get_width();
+	int h = src.get_height();
+	int c = src.get_channels();
+	dst = ImageT<T>((h + 1) / 2, (w + 1) / 2, c);
+	if (!src.buffer())
+		return;
+
+	const T *in = src.buffer();
+	T *out = dst.buffer();
+	size_t in_line = (size_t)w * c;
+	size_t out_line = (size_t)dst.get_width() * c;
+
+	parallel_bands(dst.get_height(), [=](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			const T *r0 = in + 2 * y * in_line;
+			const T *r1 = 2 * y + 1 < h ? r0 + in_line : r0;
+			downsample2x_row(r0, r1, out + y * out_line, w, c);
+		}
+	});
+}
+
+template void downsample2x(const ImageT<uint16_t> &, ImageT<uint16_t> &);
+template void downsample2x(const ImageT<float> &, ImageT<float> &);
+
+static void make_dir(const std::string &path)
+{
+	if (mkdir(path.c_str(), 0755)!=0 && errno!=EEXIST)
+		throw "Could not create directory";
+}
+
+Pyramid::Pyramid(int tile_size) : tile_size(tile_size), bytespp(0)
+{
+}
+
+int Pyramid::get_levels()
+{
+	return levels.size();
+}
+
+bool Pyramid::build(const char *filename, const char *out_dir)
+{
+	PROFILE_SCOPE(OP_PYRAMID);
+	try
+	{
+		if (tile_size < 2 || tile_size % 2)
+			throw "Tile size must be a positive even number";
+
+		BMPHeader header = Image::probe_bmp(filename);
+		int w = header.infoHeader.width_px;
+		int h = abs(header.infoHeader.height_px);
+		if (w <= 0 || h <= 0)
+			throw "Could not read data from file";
+
+		this->out_dir = out_dir;
+		levels.clear();
+		make_dir(this->out_dir);
+
+		for (int y = 0; y < h; y += tile_size)
+		{
+			int n = std::min(tile_size, h - y);
+			Image band;
+			band.read_bmp_region(filename, 0, y, w, n);
+			if (band.get_width()!=w || band.get_height()!=n)
+				throw "Could not read data from file";
+			if (band.get_bytespp()==1 && !band.is_grayscale())
+				band.to_rgb();
+
+			if (levels.empty())
+			{
+				bytespp = band.get_bytespp();
+				int lw = w;
+				int lh = h;
+				while (true)
+				{
+					Level level;
+					level.width = lw;
+					level.height = lh;
+					level.band_y = 0;
+					level.rows = 0;
+					levels.push_back(level);
+					if (lw <= tile_size && lh <= tile_size)
+						break;
+					lw = (lw + 1) / 2;
+					lh = (lh + 1) / 2;
+				}
+				for (size_t i = 0; i < levels.size(); i++)
+				{
+					levels[i].band = Image(tile_size, levels[i].width, bytespp);
+					char name[32];
+					snprintf(name, sizeof(name), "/%zu", i);
+					make_dir(this->out_dir + name);
+				}
+			}
+
+			push_rows(0, band.buffer(), n);
+		}
+
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			flush(i);
+		}
+		return true;
+	}
+	catch (const char* msg) 
+	{
+    std::cerr << msg << std::endl;
+		return false;
+  }
+}
+
+void Pyramid::push_rows(size_t level, const uint8_t *rows, int n)
+{
+	Level &lvl = levels[level];
+	size_t line = (size_t)lvl.width * bytespp;
+	while (n > 0)
+	{
+		int k = std::min(n, tile_size - lvl.rows);
+		memcpy(lvl.band.buffer() + lvl.rows * line, rows, k * line);
+		lvl.rows += k;
+		rows += k * line;
+		n -= k;
+		if (lvl.rows == tile_size)
+			flush(level);
+	}
+}
+
+void Pyramid::flush(size_t level)
+{
+	Level &lvl = levels[level];
+	if (lvl.rows == 0)
+		return;
+
+	write_tiles(level);
+
+	if (level + 1 < levels.size())
+	{
+		int w = lvl.width;
+		int rows = lvl.rows;
+		int bpp = bytespp;
+		size_t in_line = (size_t)w * bpp;
+		size_t out_line = (size_t)levels[level + 1].width * bpp;
+		int out_rows = (rows + 1) / 2;
+		std::vector<uint8_t> half(out_rows * out_line);
+
+		const uint8_t *in = lvl.band.buffer();
+		uint8_t *out = &half[0];
+		parallel_bands(out_rows, [=](int begin, int end) {
+			for (int y = begin; y < end; y++)
+			{
+				const uint8_t *r0 = in + 2 * y * in_line;
+				const uint8_t *r1 = 2 * y + 1 < rows ? r0 + in_line : r0;
+				downsample2x_row(r0, r1, out + y * out_line, w, bpp);
+			}
+		});
+
+		lvl.band_y += lvl.rows;
+		lvl.rows = 0;
+		push_rows(level + 1, &half[0], out_rows);
+	}
+	else
+	{
+		lvl.band_y += lvl.rows;
+		lvl.rows = 0;
+	}
+}
+
+void Pyramid::write_tiles(size_t level)
+{
+	Level &lvl = levels[level];
+	int cols = (lvl.width + tile_size - 1) / tile_size;
+	int tile_row = lvl.band_y / tile_size;
+	int rows = lvl.rows;
+	int width = lvl.width;
+	int size = tile_size;
+	std::string dir = out_dir;
+
+	// Views are made here, on one thread, and only written out in parallel.
+	std::vector<std::unique_ptr<Image>> tiles(cols);
+	for (int col = 0; col < cols; col++)
+	{
+		int tw = std::min(size, width - col * size);
+		tiles[col].reset(new Image(lvl.band, col * size, 0, tw, rows));
+	}
+
+	parallel_bands(cols, [&](int begin, int end) {
+		for (int col = begin; col < end; col++)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "/%zu/%d_%d.bmp", level, tile_row, col);
+			tiles[col]->write_bmp((dir + name).c_str());
+		}
+	}, 1);
+}
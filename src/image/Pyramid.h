@@ -0,0 +1,53 @@
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include <string>
+#include <vector>
+
+#include "Image.h"
+#include "ImageT.h"
+
+#define DEFAULT_TILE_SIZE   256
+
+// Halves an image in both directions with a 2x2 box filter. Indexed images
+// are filtered on their indices, so expand non-grayscale palettes first.
+void downsample2x(const Image &src, Image &dst);
+template <typename T>
+void downsample2x(const ImageT<T> &src, ImageT<T> &dst);
+
+// Builds a tiled image pyramid from a BMP on disk. Level 0 is the source at
+// full resolution and every following level is half the size of the one
+// before it, down to the first level that fits in a single tile. Tiles are
+// written to <out_dir>/<level>/<row>_<col>.bmp.
+//
+// The source is streamed in bands of tile_size rows, and every level holds
+// at most one band, so memory use is bounded by the band sizes rather than
+// by the size of the source.
+class Pyramid
+{
+	struct Level
+	{
+		int width;
+		int height;
+		int band_y;
+		int rows;
+		Image band;
+	};
+
+	int tile_size;
+	int bytespp;
+	std::string out_dir;
+	std::vector<Level> levels;
+
+	void push_rows(size_t level, const uint8_t *rows, int n);
+	void flush(size_t level);
+	void write_tiles(size_t level);
+
+public:
+	Pyramid(int tile_size = DEFAULT_TILE_SIZE);
+
+	bool build(const char *filename, const char *out_dir);
+	int get_levels();
+};
+
+#endif //__PYRAMID_H__
@@ -0,0 +1,329 @@
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+#include "Quantize.h"
+#include "Parallel.h"
+#include "Profile.h"
+
+#define QUANT_BITS          5
+#define QUANT_SIDE          (1 << QUANT_BITS)
+#define QUANT_CELLS         (QUANT_SIDE * QUANT_SIDE * QUANT_SIDE)
+#define QUANT_SHIFT         (BITS_PER_BYTE - QUANT_BITS)
+
+static const uint8_t BAYER8[8][8] = {
+	{ 0, 32,  8, 40,  2, 34, 10, 42},
+	{48, 16, 56, 24, 50, 18, 58, 26},
+	{12, 44,  4, 36, 14, 46,  6, 38},
+	{60, 28, 52, 20, 62, 30, 54, 22},
+	{ 3, 35, 11, 43,  1, 33,  9, 41},
+	{51, 19, 59, 27, 49, 17, 57, 25},
+	{15, 47,  7, 39, 13, 45,  5, 37},
+	{63, 31, 55, 23, 61, 29, 53, 21}
+};
+
+static inline int cell(int r, int g, int b)
+{
+	return ((r >> QUANT_SHIFT) << (2 * QUANT_BITS)) | ((g >> QUANT_SHIFT) << QUANT_BITS) | (b >> QUANT_SHIFT);
+}
+
+struct ColourHistogram
+{
+	std::vector<uint32_t> count;
+	std::vector<uint64_t> sum[3];
+
+	ColourHistogram() : count(QUANT_CELLS, 0)
+	{
+		for (int c = 0; c < 3; c++)
+			sum[c].assign(QUANT_CELLS, 0);
+	}
+};
+
+struct Box
+{
+	int lo[3];
+	int hi[3];
+	uint64_t count;
+};
+
+static uint32_t cell_count(const ColourHistogram &h, int r, int g, int b)
+{
+	return h.count[(r << (2 * QUANT_BITS)) | (g << QUANT_BITS) | b];
+}
+
+// Tightens a box to the cells it actually contains and recounts it.
+static void shrink(const ColourHistogram &h, Box &box)
+{
+	int lo[3] = {QUANT_SIDE, QUANT_SIDE, QUANT_SIDE};
+	int hi[3] = {-1, -1, -1};
+	box.count = 0;
+	for (int r = box.lo[0]; r <= box.hi[0]; r++)
+		for (int g = box.lo[1]; g <= box.hi[1]; g++)
+			for (int b = box.lo[2]; b <= box.hi[2]; b++)
+			{
+				uint32_t n = cell_count(h, r, g, b);
+				if (!n)
+					continue;
+				box.count += n;
+				int v[3] = {r, g, b};
+				for (int c = 0; c < 3; c++)
+				{
+					lo[c] = std::min(lo[c], v[c]);
+					hi[c] = std::max(hi[c], v[c]);
+				}
+			}
+	if (box.count)
+		for (int c = 0; c < 3; c++)
+		{
+			box.lo[c] = lo[c];
+			box.hi[c] = hi[c];
+		}
+}
+
+static bool split(const ColourHistogram &h, Box &box, Box &other)
+{
+	int axis = 0;
+	for (int c = 1; c < 3; c++)
+		if (box.hi[c] - box.lo[c] > box.hi[axis] - box.lo[axis])
+			axis = c;
+	if (box.hi[axis] == box.lo[axis])
+		return false;
+
+	std::vector<uint64_t> plane(QUANT_SIDE, 0);
+	for (int r = box.lo[0]; r <= box.hi[0]; r++)
+		for (int g = box.lo[1]; g <= box.hi[1]; g++)
+			for (int b = box.lo[2]; b <= box.hi[2]; b++)
+			{
+				int v[3] = {r, g, b};
+				plane[v[axis]] += cell_count(h, r, g, b);
+			}
+
+	uint64_t acc = 0;
+	int s = box.lo[axis];
+	for (; s < box.hi[axis] - 1; s++)
+	{
+		acc += plane[s];
+		if (2 * acc >= box.count)
+			break;
+	}
+
+	other = box;
+	box.hi[axis] = s;
+	other.lo[axis] = s + 1;
+	shrink(h, box);
+	shrink(h, other);
+	return true;
+}
+
+int median_cut_palette(const Image &img, uint8_t *palette, int max_colours)
+{
+	int channels = img.get_bytespp();
+	if (!img.buffer() || channels < Image::RGB || max_colours < 1)
+		return 0;
+	if (max_colours > NUM_COLORS)
+		max_colours = NUM_COLORS;
+
+	int w = img.get_width();
+	const uint8_t *data = img.buffer();
+	size_t stride = img.get_stride();
+	ColourHistogram hist;
+	std::mutex lock;
+
+	parallel_bands(img.get_height(), [&](int begin, int end) {
+		ColourHistogram local;
+		for (int y = begin; y < end; y++)
+		{
+			const uint8_t *p = data + y * stride;
+			for (int x = 0; x < w; x++, p += channels)
+			{
+				int i = cell(p[0], p[1], p[2]);
+				local.count[i]++;
+				local.sum[0][i] += p[0];
+				local.sum[1][i] += p[1];
+				local.sum[2][i] += p[2];
+			}
+		}
+		std::lock_guard<std::mutex> guard(lock);
+		for (int i = 0; i < QUANT_CELLS; i++)
+		{
+			if (!local.count[i])
+				continue;
+			hist.count[i] += local.count[i];
+			for (int c = 0; c < 3; c++)
+				hist.sum[c][i] += local.sum[c][i];
+		}
+	}, 64);
+
+	std::vector<Box> boxes(1);
+	for (int c = 0; c < 3; c++)
+	{
+		boxes[0].lo[c] = 0;
+		boxes[0].hi[c] = QUANT_SIDE - 1;
+	}
+	shrink(hist, boxes[0]);
+
+	std::vector<bool> done(1, false);
+	while ((int)boxes.size() < max_colours)
+	{
+		int best = -1;
+		for (size_t i = 0; i < boxes.size(); i++)
+			if (!done[i] && (best < 0 || boxes[i].count > boxes[best].count))
+				best = i;
+		if (best < 0)
+			break;
+
+		Box other;
+		if (!split(hist, boxes[best], other))
+		{
+			done[best] = true;
+			continue;
+		}
+		boxes.push_back(other);
+		done.push_back(false);
+	}
+
+	int n = 0;
+	for (size_t i = 0; i < boxes.size(); i++)
+	{
+		const Box &box = boxes[i];
+		uint64_t sum[3] = {0, 0, 0};
+		for (int r = box.lo[0]; r <= box.hi[0]; r++)
+			for (int g = box.lo[1]; g <= box.hi[1]; g++)
+				for (int b = box.lo[2]; b <= box.hi[2]; b++)
+				{
+					int j = (r << (2 * QUANT_BITS)) | (g << QUANT_BITS) | b;
+					for (int c = 0; c < 3; c++)
+						sum[c] += hist.sum[c][j];
+				}
+		if (!box.count)
+			continue;
+		uint8_t *entry = palette + n * RGBAQUAD;
+		entry[2] = (sum[0] + box.count / 2) / box.count;
+		entry[1] = (sum[1] + box.count / 2) / box.count;
+		entry[0] = (sum[2] + box.count / 2) / box.count;
+		entry[3] = 0x00;
+		n++;
+	}
+	return n;
+}
+
+// Nearest palette entry for the centre of every cell of the colour cube.
+static void inverse_map(const uint8_t *palette, int n, std::vector<uint8_t> &map)
+{
+	map.resize(QUANT_CELLS);
+	parallel_bands(QUANT_SIDE, [&](int begin, int end) {
+		for (int r = begin; r < end; r++)
+			for (int g = 0; g < QUANT_SIDE; g++)
+				for (int b = 0; b < QUANT_SIDE; b++)
+				{
+					int cr = (r << QUANT_SHIFT) + (1 << (QUANT_SHIFT - 1));
+					int cg = (g << QUANT_SHIFT) + (1 << (QUANT_SHIFT - 1));
+					int cb = (b << QUANT_SHIFT) + (1 << (QUANT_SHIFT - 1));
+					int best = 0;
+					int best_d = 0x7FFFFFFF;
+					for (int i = 0; i < n; i++)
+					{
+						const uint8_t *e = palette + i * RGBAQUAD;
+						int dr = cr - e[2];
+						int dg = cg - e[1];
+						int db = cb - e[0];
+						int d = dr * dr + dg * dg + db * db;
+						if (d < best_d)
+						{
+							best_d = d;
+							best = i;
+						}
+					}
+					map[(r << (2 * QUANT_BITS)) | (g << QUANT_BITS) | b] = best;
+				}
+	}, 1);
+}
+
+static inline int clamp_channel(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+bool quantize(Image &img, Dither dither, int max_colours)
+{
+	int channels = img.get_bytespp();
+	if (channels == Image::GRAYSCALE)
+		return true;
+	PROFILE_SCOPE(OP_QUANTIZE);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+
+	uint8_t palette[NUM_COLORS * RGBAQUAD];
+	memset(palette, 0, sizeof(palette));
+	int n = median_cut_palette(img, palette, max_colours);
+	if (n == 0)
+		return false;
+
+	std::vector<uint8_t> map;
+	inverse_map(palette, n, map);
+
+	int w = img.get_width();
+	int h = img.get_height();
+	const uint8_t *src = static_cast<const Image &>(img).buffer();
+	size_t stride = img.get_stride();
+	Image out(h, w, Image::GRAYSCALE);
+	out.set_Palette(palette, NUM_COLORS);
+	uint8_t *dst = out.buffer();
+
+	if (dither == DITHER_FLOYD_STEINBERG)
+	{
+		// Error diffusion is inherently sequential in scan order.
+		std::vector<int> cur((w + 2) * 3, 0);
+		std::vector<int> next((w + 2) * 3, 0);
+		for (int y = 0; y < h; y++)
+		{
+			const uint8_t *p = src + y * stride;
+			for (int x = 0; x < w; x++, p += channels)
+			{
+				int *e = &cur[(x + 1) * 3];
+				int r = clamp_channel(p[0] + e[0] / 16);
+				int g = clamp_channel(p[1] + e[1] / 16);
+				int b = clamp_channel(p[2] + e[2] / 16);
+				uint8_t idx = map[cell(r, g, b)];
+				dst[(size_t)y * w + x] = idx;
+
+				const uint8_t *entry = palette + idx * RGBAQUAD;
+				int err[3] = {r - entry[2], g - entry[1], b - entry[0]};
+				for (int c = 0; c < 3; c++)
+				{
+					cur[(x + 2) * 3 + c] += err[c] * 7;
+					next[x * 3 + c] += err[c] * 3;
+					next[(x + 1) * 3 + c] += err[c] * 5;
+					next[(x + 2) * 3 + c] += err[c];
+				}
+			}
+			cur.swap(next);
+			std::fill(next.begin(), next.end(), 0);
+		}
+	}
+	else
+	{
+		bool ordered = dither == DITHER_ORDERED;
+		parallel_bands(h, [&](int begin, int end) {
+			for (int y = begin; y < end; y++)
+			{
+				const uint8_t *p = src + y * stride;
+				uint8_t *row = dst + (size_t)y * w;
+				for (int x = 0; x < w; x++, p += channels)
+				{
+					if (ordered)
+					{
+						int d = (BAYER8[y & 7][x & 7] * 2 - 63) / 4;
+						row[x] = map[cell(clamp_channel(p[0] + d), clamp_channel(p[1] + d), clamp_channel(p[2] + d))];
+					}
+					else
+					{
+						row[x] = map[cell(p[0], p[1], p[2])];
+					}
+				}
+			}
+		});
+	}
+
+	img = out;
+	return true;
+}
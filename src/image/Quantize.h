@@ -0,0 +1,21 @@
+#ifndef __QUANTIZE_H__
+#define __QUANTIZE_H__
+
+#include "Image.h"
+
+enum Dither
+{
+	DITHER_NONE,
+	DITHER_ORDERED,				// 8x8 Bayer matrix
+	DITHER_FLOYD_STEINBERG
+};
+
+// Median cut over a 5 bit per channel colour histogram. Fills palette with up
+// to max_colours BGRA entries and returns how many were used.
+int median_cut_palette(const Image &img, uint8_t *palette, int max_colours = NUM_COLORS);
+
+// Converts an RGB or RGBA image to 8 bit indexed colour in place. Pixels are
+// matched to the palette through a precomputed 32x32x32 inverse colour map.
+bool quantize(Image &img, Dither dither = DITHER_NONE, int max_colours = NUM_COLORS);
+
+#endif //__QUANTIZE_H__
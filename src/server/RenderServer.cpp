@@ -0,0 +1,436 @@
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BlockingQueue.h"
+#include "ImageCache.h"
+#include "Scene.h"
+
+// Long-running renderer, so clients need not start a process per image.
+// Jobs arrive on stdin, or from any number of clients of a Unix socket, and
+// are rendered by a pool of worker threads into canvases that are reused
+// from job to job.
+//
+//   render_server [--socket <path>] [--threads <n>] [--canvases <n>]
+//                 [--size <w>x<h>x<bytespp>]
+//
+// A job is a scene in the text form described in Scene.h, followed by a line
+// holding only "end". The reply to the n-th job on a connection is either
+//
+//   ok <n> <length>\n<length bytes of BMP>
+//   error <n> <message>\n
+//
+// Replies are sent as jobs finish, which need not be the order they arrived
+// in. A line holding only "stats" is answered with
+//
+//   stats <jobs> p50 <ms> p99 <ms>\n
+//
+// covering every job since startup, timed from the "end" line to the reply.
+// The percentiles are rounded up to the nearest of a fixed set of values
+// about 9% apart. In stdin mode the same line goes to stderr once stdin is
+// closed. A job longer than MAX_JOB_BYTES is answered with an error at once
+// and the rest of it, up to its "end", is skipped.
+//
+// --canvases canvases of --size (default 1024x1024x3) are allocated up front;
+// jobs of other sizes allocate their own, and the pool keeps up to that many
+// of whatever sizes were used last. Images referenced by scenes go through
+// the decoded image cache, which is enabled with 256 MB unless IMAGE_CACHE_MB
+// says otherwise.
+
+#define DEFAULT_CANVASES    8
+#define DEFAULT_CACHE_MB    256
+#define READ_CHUNK          65536
+#define MAX_JOB_BYTES       (16 << 20)
+#define LATENCY_BUCKETS     256
+#define LATENCY_PER_OCTAVE  8
+#define LATENCY_MIN_MS      0.001
+
+typedef std::chrono::steady_clock Clock;
+
+struct Connection
+{
+	int in;
+	int out;
+	std::mutex lock;		// Serialises replies
+
+	Connection(int in, int out) : in(in), out(out)
+	{
+	}
+
+	~Connection()
+	{
+		if (in > 2)
+			close(in);
+		if (out > 2 && out != in)
+			close(out);
+	}
+
+	bool write_all(const void *bytes, size_t len)
+	{
+		const uint8_t *p = (const uint8_t *)bytes;
+		while (len > 0)
+		{
+			ssize_t n = write(out, p, len);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	bool reply(const std::string &head, const std::vector<uint8_t> *body)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (!write_all(head.data(), head.size()))
+			return false;
+		return !body || body->empty() || write_all(&(*body)[0], body->size());
+	}
+};
+
+struct Job
+{
+	std::shared_ptr<Connection> conn;
+	uint64_t id;
+	std::string text;
+	Clock::time_point start;
+};
+
+class CanvasPool
+{
+	std::mutex lock;
+	std::vector<Sketch *> free;
+	size_t limit;
+
+public:
+	CanvasPool(size_t limit, int w, int h, int bytespp) : limit(limit)
+	{
+		for (size_t i = 0; i < limit; i++)
+			free.push_back(new Sketch(h, w, bytespp));
+	}
+
+	~CanvasPool()
+	{
+		for (size_t i = 0; i < free.size(); i++)
+			delete free[i];
+	}
+
+	Sketch *acquire(int w, int h, int bytespp)
+	{
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			for (size_t i = free.size(); i-- > 0; )
+			{
+				Sketch *canvas = free[i];
+				if (canvas->get_width() == w && canvas->get_height() == h && canvas->get_bytespp() == bytespp)
+				{
+					free.erase(free.begin() + i);
+					return canvas;
+				}
+			}
+		}
+		return new Sketch(h, w, bytespp);
+	}
+
+	// A full pool drops its least recently used canvas.
+	void release(Sketch *canvas)
+	{
+		Sketch *dropped = NULL;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (free.size() >= limit && !free.empty())
+			{
+				dropped = free.front();
+				free.erase(free.begin());
+			}
+			if (limit > 0)
+				free.push_back(canvas);
+			else
+				dropped = canvas;
+		}
+		delete dropped;
+	}
+};
+
+// Latencies are counted in buckets each 2^(1/8) (about 9%) wider than the
+// last, from 1 us up, so memory and the cost of a report stay fixed however
+// long the server runs.
+class LatencyStats
+{
+	std::mutex lock;
+	uint64_t counts[LATENCY_BUCKETS];
+	uint64_t total;
+
+	static int bucket(double ms)
+	{
+		if (ms <= LATENCY_MIN_MS)
+			return 0;
+		int b = (int)(log2(ms / LATENCY_MIN_MS) * LATENCY_PER_OCTAVE) + 1;
+		return std::min(b, LATENCY_BUCKETS - 1);
+	}
+
+	// The upper bound of the bucket holding the pth latency.
+	static double percentile(const uint64_t *counts, uint64_t total, double p)
+	{
+		if (!total)
+			return 0.0;
+		uint64_t k = std::min(total - 1, (uint64_t)(p * total));
+		uint64_t seen = 0;
+		int b = 0;
+		for (; b < LATENCY_BUCKETS - 1; b++)
+		{
+			seen += counts[b];
+			if (seen > k)
+				break;
+		}
+		return LATENCY_MIN_MS * exp2((double)b / LATENCY_PER_OCTAVE);
+	}
+
+public:
+	LatencyStats() : total(0)
+	{
+		memset(counts, 0, sizeof(counts));
+	}
+
+	void add(double ms)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		counts[bucket(ms)]++;
+		total++;
+	}
+
+	std::string report()
+	{
+		uint64_t c[LATENCY_BUCKETS];
+		uint64_t n;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			memcpy(c, counts, sizeof(c));
+			n = total;
+		}
+		char line[128];
+		double p50 = percentile(c, n, 0.50);
+		double p99 = percentile(c, n, 0.99);
+		snprintf(line, sizeof(line), "stats %llu p50 %.3f p99 %.3f\n", (unsigned long long)n, p50, p99);
+		return line;
+	}
+};
+
+struct Server
+{
+	BlockingQueue<Job> jobs;
+	CanvasPool canvases;
+	LatencyStats latency;
+
+	Server(size_t pooled, int w, int h, int bytespp) : canvases(pooled, w, h, bytespp)
+	{
+	}
+
+	void work()
+	{
+		Job job;
+		std::vector<uint8_t> bmp;
+		std::string error;
+		while (jobs.pop(job))
+		{
+			Scene scene;
+			bool ok = parse_scene(job.text.data(), job.text.size(), scene, error);
+			if (ok)
+			{
+				Sketch *canvas = canvases.acquire(scene.width, scene.height, scene.bytespp);
+				ok = render_scene(scene, *canvas, error);
+				if (ok)
+					canvas->encode_bmp(bmp);
+				canvases.release(canvas);
+			}
+
+			std::string head = (ok ? "ok " : "error ") + std::to_string(job.id) + " ";
+			head += ok ? std::to_string(bmp.size()) : error;
+			head += "\n";
+			job.conn->reply(head, ok ? &bmp : NULL);
+			latency.add(std::chrono::duration<double, std::milli>(Clock::now() - job.start).count());
+			job.conn.reset();
+		}
+	}
+
+	// Reads jobs from a connection until it closes.
+	void serve(std::shared_ptr<Connection> conn)
+	{
+		std::vector<char> buf(READ_CHUNK);
+		std::string line;
+		std::string text;
+		uint64_t id = 0;
+		bool discarding = false;	// Skipping the rest of an oversized job
+		for (;;)
+		{
+			ssize_t n = read(conn->in, &buf[0], buf.size());
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return;
+			for (ssize_t i = 0; i < n; i++)
+			{
+				if (buf[i] != '\n')
+				{
+					// While discarding, a few bytes are enough to spot "end".
+					if (!discarding || line.size() < 5)
+						line += buf[i];
+					if (!discarding && text.size() + line.size() > MAX_JOB_BYTES)
+					{
+						conn->reply("error " + std::to_string(++id) + " job too large\n", NULL);
+						std::string().swap(text);
+						std::string().swap(line);
+						discarding = true;
+					}
+					continue;
+				}
+				if (!line.empty() && line[line.size() - 1] == '\r')
+					line.erase(line.size() - 1);
+
+				if (discarding)
+				{
+					discarding = line != "end";
+				}
+				else if (line == "end")
+				{
+					Job job;
+					job.conn = conn;
+					job.id = ++id;
+					job.text.swap(text);
+					job.start = Clock::now();
+					jobs.push(job);
+				}
+				else if (line == "stats" && text.empty())
+				{
+					conn->reply(latency.report(), NULL);
+				}
+				else
+				{
+					text += line;
+					text += '\n';
+				}
+				line.clear();
+			}
+		}
+	}
+};
+
+static int listen_unix(const char *path)
+{
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+	{
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int usage()
+{
+	fprintf(stderr, "usage: render_server [--socket path] [--threads n] [--canvases n] [--size WxHxB]\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = NULL;
+	int threads = std::thread::hardware_concurrency();
+	int pooled = DEFAULT_CANVASES;
+	int w = 1024, h = 1024, bytespp = Image::RGB;
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "--socket") && has_value)
+			socket_path = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && has_value)
+			threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--canvases") && has_value)
+			pooled = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--size") && has_value)
+		{
+			if (sscanf(argv[++i], "%dx%dx%d", &w, &h, &bytespp) != 3 || w <= 0 || h <= 0 ||
+			    (bytespp != Image::GRAYSCALE && bytespp != Image::RGB && bytespp != Image::RGBA))
+				return usage();
+		}
+		else
+			return usage();
+	}
+	threads = std::max(threads, 1);
+	pooled = std::max(pooled, 0);
+
+	// A client that hangs up mid-reply must not take the server down.
+	signal(SIGPIPE, SIG_IGN);
+	ImageCache &cache = ImageCache::shared();
+	if (!cache.enabled())
+		cache.enable((size_t)DEFAULT_CACHE_MB << 20);
+
+	Server server(pooled, w, h, bytespp);
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; i++)
+		workers.push_back(std::thread(&Server::work, &server));
+
+	if (!socket_path)
+	{
+		server.serve(std::make_shared<Connection>(STDIN_FILENO, STDOUT_FILENO));
+		server.jobs.close();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+		std::string stats = server.latency.report();
+		fputs(stats.c_str(), stderr);
+		return 0;
+	}
+
+	int listener = listen_unix(socket_path);
+	if (listener < 0)
+		return 1;
+	for (;;)
+	{
+		int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			perror("accept");
+			break;
+		}
+		std::thread(&Server::serve, &server, std::make_shared<Connection>(fd, fd)).detach();
+	}
+	close(listener);
+	server.jobs.close();
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+	return 1;
+}
@@ -0,0 +1,635 @@
+#ifndef __BASIC_SKETCH_H__
+#define __BASIC_SKETCH_H__
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "Image.h"
+#include "Kernels.h"
+
+// Drawing primitives specialised on the pixel format at compile time. A
+// BasicSketch does not own its pixels; it draws into a top-down buffer of
+// width * height pixels whose rows may be further apart than width, as in a
+// sub-image. Sketch picks the right specialisation from bytespp and forwards
+// to it.
+
+template <typename T>
+struct ChannelTraits;
+
+template <>
+struct ChannelTraits<uint8_t>
+{
+	static uint8_t from8(uint8_t v) { return v; }
+};
+
+template <>
+struct ChannelTraits<uint16_t>
+{
+	static uint16_t from8(uint8_t v) { return (uint16_t)(v * 257); }
+};
+
+template <>
+struct ChannelTraits<float>
+{
+	static float from8(uint8_t v) { return v * (1.0f / 255.0f); }
+};
+
+template <typename T, int C>
+struct PixelFormat
+{
+	typedef T channel_type;
+	enum { channels = C };
+
+	struct Pixel
+	{
+		T v[C];
+	};
+
+	// Builds a pixel from the first C of four 8-bit components, the same
+	// bytes Sketch::set copies for an 8-bit image.
+	static Pixel pixel(const uint8_t *raw)
+	{
+		Pixel p;
+		for (int c = 0; c < C; c++)
+			p.v[c] = ChannelTraits<T>::from8(raw[c]);
+		return p;
+	}
+};
+
+typedef PixelFormat<uint8_t, 1> Gray8;
+typedef PixelFormat<uint8_t, 3> RGB8;
+typedef PixelFormat<uint8_t, 4> RGBA8;
+typedef PixelFormat<uint16_t, 1> Gray16;
+typedef PixelFormat<uint16_t, 3> RGB16;
+typedef PixelFormat<uint16_t, 4> RGBA16;
+typedef PixelFormat<float, 1> GrayF;
+typedef PixelFormat<float, 3> RGBF;
+typedef PixelFormat<float, 4> RGBAF;
+
+template <typename PF>
+class BasicSketch
+{
+public:
+	typedef typename PF::channel_type channel_type;
+	typedef typename PF::Pixel Pixel;
+	enum { channels = PF::channels };
+
+private:
+	channel_type *data;
+	int width;
+	int height;
+	size_t stride;		// Samples from one row to the next
+
+	channel_type *at(int x, int y) const
+	{
+		return data + (size_t)y * stride + (size_t)x * channels;
+	}
+
+	static bool same(const channel_type *p, const Pixel &px)
+	{
+		for (int c = 0; c < channels; c++)
+			if (p[c] != px.v[c])
+				return false;
+		return true;
+	}
+
+	static void put(channel_type *p, const Pixel &px)
+	{
+		for (int c = 0; c < channels; c++)
+			p[c] = px.v[c];
+	}
+
+	// 8-bit spans go to the dispatched fill kernel.
+	static void put_n(uint8_t *p, int n, const Pixel &px)
+	{
+		fill_row(p, n, px.v, channels);
+	}
+
+	template <typename T>
+	static void put_n(T *p, int n, const Pixel &px)
+	{
+		for (int x = 0; x < n; x++, p += channels)
+			put(p, px);
+	}
+
+	bool oct1(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool oct2(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool oct3(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool oct4(int x0, int y0, int x1, int y1, const Pixel &px);
+
+public:
+	// A stride of 0 means rows are packed.
+	BasicSketch(channel_type *data, int width, int height, size_t stride = 0)
+		: data(data), width(width), height(height), stride(stride ? stride : (size_t)width * channels)
+	{
+	}
+
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+	channel_type *buffer() const { return data; }
+	size_t get_stride() const { return stride; }
+
+	bool set(int x, int y, const Pixel &px)
+	{
+		if (!data || x < 0 || y < 0 || x >= width || y >= height)
+			return false;
+		put(at(x, y), px);
+		return true;
+	}
+
+	Pixel get(int x, int y) const
+	{
+		Pixel px = Pixel();
+		if (!data || x < 0 || y < 0 || x >= width || y >= height)
+			return px;
+		const channel_type *p = at(x, y);
+		for (int c = 0; c < channels; c++)
+			px.v[c] = p[c];
+		return px;
+	}
+
+	// Fills [x0, x1) of row y, clipped to the image.
+	void fill_span(int x0, int x1, int y, const Pixel &px);
+	void fill_column(int x, int y0, int y1, const Pixel &px);
+
+	bool fill(const Pixel &px)
+	{
+		if (!data)
+			return false;
+		for (int y = 0; y < height; y++)
+			fill_span(0, width, y, px);
+		return true;
+	}
+
+	bool flip_horizontally();
+	bool flip_vertically();
+	bool scale_to(BasicSketch dst) const;
+
+	bool draw_line(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool draw_line2(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool draw_line3(int x0, int y0, int x1, int y1, const Pixel &px);
+	bool draw_triangle(Vector2i t0, Vector2i t1, Vector2i t2, const Pixel &px);
+	bool draw_image(const BasicSketch &src, int x_anchor, int y_anchor);
+
+	// Replaces the 4-connected region of pixels equal to the one at (x, y)
+	// with px.
+	bool flood_fill(int x, int y, const Pixel &px);
+};
+
+template <typename PF>
+void BasicSketch<PF>::fill_span(int x0, int x1, int y, const Pixel &px)
+{
+	if (!data || y < 0 || y >= height)
+		return;
+	x0 = std::max(x0, 0);
+	x1 = std::min(x1, width);
+	if (x0 < x1)
+		put_n(at(x0, y), x1 - x0, px);
+}
+
+template <typename PF>
+void BasicSketch<PF>::fill_column(int x, int y0, int y1, const Pixel &px)
+{
+	if (!data || x < 0 || x >= width)
+		return;
+	y0 = std::max(y0, 0);
+	y1 = std::min(y1, height);
+	for (int y = y0; y < y1; y++)
+		put(at(x, y), px);
+}
+
+template <typename PF>
+bool BasicSketch<PF>::flip_horizontally()
+{
+	if (!data)
+		return false;
+	int half = width >> 1;
+	for (int j = 0; j < height; j++)
+	{
+		channel_type *l = at(0, j);
+		channel_type *r = at(width - 1, j);
+		for (int i = 0; i < half; i++, l += channels, r -= channels)
+			for (int c = 0; c < channels; c++)
+				std::swap(l[c], r[c]);
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::flip_vertically()
+{
+	if (!data)
+		return false;
+	size_t row = (size_t)width * channels;
+	int half = height >> 1;
+	for (int j = 0; j < half; j++)
+	{
+		channel_type *a = at(0, j);
+		std::swap_ranges(a, a + row, at(0, height - 1 - j));
+	}
+	return true;
+}
+
+// Nearest neighbour resampling driven by Bresenham style error terms in both
+// directions; dst must already have its final size.
+template <typename PF>
+bool BasicSketch<PF>::scale_to(BasicSketch dst) const
+{
+	int w = dst.width;
+	int h = dst.height;
+	if (w <= 0 || h <= 0 || !data || !dst.data)
+		return false;
+	size_t nline = (size_t)w * channels;
+	int ny = 0;
+	int erry = 0;
+	for (int j = 0; j < height; j++)
+	{
+		const channel_type *src = at(0, j);
+		channel_type *out = dst.at(0, ny);
+		int errx = width - w;
+		for (int i = 0; i < width; i++, src += channels)
+		{
+			errx += w;
+			while (errx >= width)
+			{
+				errx -= width;
+				for (int c = 0; c < channels; c++)
+					out[c] = src[c];
+				out += channels;
+			}
+		}
+		erry += h;
+		while (erry >= height)
+		{
+			if (erry >= height << 1) // it means we jump over a scanline
+				std::copy(dst.at(0, ny), dst.at(0, ny) + nline, dst.at(0, ny + 1));
+			erry -= height;
+			ny++;
+		}
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::draw_image(const BasicSketch &src, int x_anchor, int y_anchor)
+{
+	if (!data || !src.data || x_anchor < 0 || y_anchor < 0 ||
+	    src.height + y_anchor > height || src.width + x_anchor > width)
+		return false;
+	size_t row = (size_t)src.width * channels;
+	for (int y = 0; y < src.height; y++)
+		std::copy(src.at(0, y), src.at(0, y) + row, at(x_anchor, y + y_anchor));
+	return true;
+}
+
+#pragma region drawLine
+template <typename PF>
+bool BasicSketch<PF>::oct1(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	int dx = x1 - x0;
+	int dy = y1 - y0;
+	int D = 2 * dy - dx;
+	int y = y0;
+
+	for (int x = x0; x < x1; ++x)
+	{
+		if (!set(x, y, px))
+			return false;
+		if (D > 0)
+		{
+			y++;
+			D -= 2 * dx;
+		}
+		D += 2 * dy;
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::oct2(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	int dx = x1 - x0;
+	int dy = y1 - y0;
+	int D = 2 * dx - dy;
+	int x = x0;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		if (!set(x, y, px))
+			return false;
+		if (D > 0)
+		{
+			x++;
+			D -= 2 * dy;
+		}
+		D += 2 * dx;
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::oct3(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	int dx = x0 - x1;
+	int dy = y1 - y0;
+	int D = 2 * dx - dy;
+	int x = x0;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		if (!set(x, y, px))
+			return false;
+		if (D > 0)
+		{
+			x--;
+			D -= 2 * dy;
+		}
+		D += 2 * dx;
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::oct4(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	int dx = x0 - x1;
+	int dy = y1 - y0;
+	int D = 2 * dy - dx;
+	int y = y0;
+
+	for (int x = x0; x > x1; --x)
+	{
+		if (!set(x, y, px))
+			return false;
+		if (D > 0)
+		{
+			y++;
+			D -= 2 * dx;
+		}
+		D += 2 * dy;
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::draw_line(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	int dy = y1 - y0;
+	int dx = x1 - x0;
+
+	// Points and lines parallel to axis
+	if (dy == 0)
+	{
+		if (dx == 0)
+			return set(x0, y0, px);
+		fill_span(std::min(x0, x1), std::max(x0, x1), y0, px);
+		return true;
+	}
+
+	if (dx == 0)
+	{
+		fill_column(x0, std::min(y0, y1), std::max(y0, y1), px);
+		return true;
+	}
+
+	// Octants 5-8 are 1-4 drawn from the other end
+	if ((dy < 0) == (dx < 0))
+	{ // positive (downwards) slope
+		if (abs(dy) > abs(dx))
+		{ // steep slope
+			if (x0 < x1)
+				oct2(x0, y0, x1, y1, px);
+			else
+				oct2(x1, y1, x0, y0, px);
+		}
+		else
+		{ // shallow slope
+			if (x0 < x1)
+				oct1(x0, y0, x1, y1, px);
+			else
+				oct1(x1, y1, x0, y0, px);
+		}
+	}
+	else
+	{ // negative (upwards) slope
+		if (abs(dy) > abs(dx))
+		{ // steep slope
+			if (x0 > x1)
+				oct3(x0, y0, x1, y1, px);
+			else
+				oct3(x1, y1, x0, y0, px);
+		}
+		else
+		{ // shallow slope
+			if (x0 > x1)
+				oct4(x0, y0, x1, y1, px);
+			else
+				oct4(x1, y1, x0, y0, px);
+		}
+	}
+	return true;
+}
+#pragma endregion drawLine
+
+template <typename PF>
+bool BasicSketch<PF>::draw_line2(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	bool steep = false;
+	if (std::abs(x0 - x1) < std::abs(y0 - y1))
+	{
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+		steep = true;
+	}
+	if (x0 > x1)
+	{
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+	int dx = x1 - x0;
+	int dy = y1 - y0;
+	int derror2 = std::abs(dy) * 2;
+	int error2 = 0;
+	int y = y0;
+	for (int x = x0; x <= x1; x++)
+	{
+		if (steep)
+			set(y, x, px);
+		else
+			set(x, y, px);
+		error2 += derror2;
+		if (error2 > dx)
+		{
+			y += (y1 > y0 ? 1 : -1);
+			error2 -= dx * 2;
+		}
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::draw_line3(int x0, int y0, int x1, int y1, const Pixel &px)
+{
+	bool steep = false;
+	if (std::abs(x0 - x1) < std::abs(y0 - y1))
+	{
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+		steep = true;
+	}
+	if (x0 > x1)
+	{
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+	int dx = x1 - x0;
+	int dy = y1 - y0;
+	int derror2 = std::abs(dy) * 2;
+	int error2 = 0;
+	int y = y0;
+	int ystep = y1 > y0 ? 1 : -1;
+	if (steep)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			set(y, x, px);
+			error2 += derror2;
+			if (error2 > dx)
+			{
+				y += ystep;
+				error2 -= dx * 2;
+			}
+		}
+	}
+	else
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			set(x, y, px);
+			error2 += derror2;
+			if (error2 > dx)
+			{
+				y += ystep;
+				error2 -= dx * 2;
+			}
+		}
+	}
+	return true;
+}
+
+template <typename PF>
+bool BasicSketch<PF>::draw_triangle(Vector2i t0, Vector2i t1, Vector2i t2, const Pixel &px)
+{
+	if (t0(1) == t1(1) && t0(1) == t2(1))
+		return true;
+
+	if (t0(1) > t1(1))
+		std::swap(t0, t1);
+	if (t0(1) > t2(1))
+		std::swap(t0, t2);
+	if (t1(1) > t2(1))
+		std::swap(t1, t2);
+
+	double m01 = double(t1(1) - t0(1)) / (t1(0) - t0(0));
+	double m02 = double(t2(1) - t0(1)) / (t2(0) - t0(0));
+	double m12 = double(t2(1) - t1(1)) / (t2(0) - t1(0));
+
+	for (size_t y = t0(1); y < t1(1); y++)
+	{
+		int xi = y / m02 - t0(1) / m02 + t0(0);
+		int xf = y / m01 - t0(1) / m01 + t0(0);
+
+		if (xi > xf)
+			std::swap(xi, xf);
+
+		fill_span(xi, xf + 1, y, px);
+	}
+	for (size_t y = t1(1); y < t2(1); y++)
+	{
+		int xi = y / m02 - t0(1) / m02 + t0(0);
+		int xf = y / m12 - t1(1) / m12 + t1(0);
+
+		if (xi > xf)
+			std::swap(xi, xf);
+
+		fill_span(xi, xf + 1, y, px);
+	}
+
+	return true;
+}
+
+// Span filling after Smith and Heckbert: each stack entry is a run [x0, x1]
+// of row y whose neighbours in row y + dy still need scanning, so the stack
+// grows with the number of runs rather than pixels and there is no recursion.
+// Runs are filled with put_n as soon as their ends are found.
+template <typename PF>
+bool BasicSketch<PF>::flood_fill(int x, int y, const Pixel &px)
+{
+	if (!data || x < 0 || y < 0 || x >= width || y >= height)
+		return false;
+	const Pixel target = get(x, y);
+	if (same(at(x, y), px))
+		return true;
+
+	struct Run
+	{
+		int x0, x1, y, dy;
+	};
+	std::vector<Run> stack;
+	Run seed = {x, x, y, 1};
+	stack.push_back(seed);
+	Run back = {x, x, y - 1, -1};
+	stack.push_back(back);
+	while (!stack.empty())
+	{
+		Run r = stack.back();
+		stack.pop_back();
+		if (r.y < 0 || r.y >= height)
+			continue;
+
+		// Extend left from x0, pushing the overhang back the way we came.
+		int x0 = r.x0;
+		int lx = x0;
+		if (same(at(x0, r.y), target))
+		{
+			while (lx > 0 && same(at(lx - 1, r.y), target))
+				lx--;
+			if (lx < x0)
+			{
+				put_n(at(lx, r.y), x0 - lx, px);
+				Run over = {lx, x0 - 1, r.y - r.dy, -r.dy};
+				stack.push_back(over);
+			}
+		}
+
+		int start = lx;
+		int cx = x0;
+		while (cx <= r.x1)
+		{
+			int end = cx;
+			while (end < width && same(at(end, r.y), target))
+				end++;
+			if (end > cx)
+				put_n(at(cx, r.y), end - cx, px);
+			if (end > start)
+			{
+				Run next = {start, end - 1, r.y + r.dy, r.dy};
+				stack.push_back(next);
+			}
+			if (end - 1 > r.x1)
+			{
+				Run over = {r.x1 + 1, end - 1, r.y - r.dy, -r.dy};
+				stack.push_back(over);
+			}
+			cx = end + 1;
+			while (cx < r.x1 && !same(at(cx, r.y), target))
+				cx++;
+			start = cx;
+		}
+	}
+	return true;
+}
+
+#endif //__BASIC_SKETCH_H__
@@ -0,0 +1,313 @@
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "Morphology.h"
+#include "Parallel.h"
+#include "Profile.h"
+#include "Region.h"
+
+// Vertical passes work on strips of this many bytes so that a strip's rows,
+// padding and scratch stay in cache.
+#define MORPH_STRIP_BYTES   64
+// Columns per strip in the first distance transform pass.
+#define EDT_STRIP_COLS      256
+#define EDT_INF             UINT32_MAX
+
+template <bool Max>
+static inline uint8_t pick(uint8_t a, uint8_t b)
+{
+	return Max ? std::max(a, b) : std::min(a, b);
+}
+
+// Running minimum or maximum over windows of 2r + 1 positions after van Herk
+// and Gil-Werman. Each of the n positions holds `lanes` independent bytes,
+// starting step bytes apart in src and dst. The input is padded with r
+// identity values on each side and cut into blocks of 2r + 1. Within a
+// block, g runs forward and h backward, so any window spans the tail of
+// one block and the head of the next and is op(h[x], g[x + 2r]): three
+// operations per position whatever r is. pad and h hold (n + 2r) * lanes
+// bytes each. A nonzero L fixes lanes at compile time so the inner loops
+// unroll.
+template <bool Max, int L>
+static void running_extreme(const uint8_t *src, uint8_t *dst, size_t step, int n, int lanes, int r, uint8_t *pad, uint8_t *h)
+{
+	if (L)
+		lanes = L;
+	const uint8_t identity = Max ? 0 : 255;
+	int k = 2 * r + 1;
+	int padded = n + 2 * r;
+	memset(pad, identity, (size_t)r * lanes);
+	if (step == (size_t)lanes)
+		memcpy(pad + (size_t)r * lanes, src, (size_t)n * lanes);
+	else
+		for (int i = 0; i < n; i++)
+			memcpy(pad + (size_t)(r + i) * lanes, src + i * step, lanes);
+	memset(pad + (size_t)(r + n) * lanes, identity, (size_t)r * lanes);
+
+	// h first, since g then overwrites pad in place.
+	for (int b = 0; b < padded; b += k)
+	{
+		int last = std::min(b + k, padded) - 1;
+		uint8_t *hj = h + (size_t)last * lanes;
+		const uint8_t *pj = pad + (size_t)last * lanes;
+		memcpy(hj, pj, lanes);
+		for (int j = last - 1; j >= b; j--)
+		{
+			hj -= lanes;
+			pj -= lanes;
+			for (int l = 0; l < lanes; l++)
+				hj[l] = pick<Max>(hj[l + lanes], pj[l]);
+		}
+		uint8_t *gj = pad + (size_t)b * lanes;
+		for (int j = b + 1; j <= last; j++)
+		{
+			gj += lanes;
+			for (int l = 0; l < lanes; l++)
+				gj[l] = pick<Max>(gj[l - lanes], gj[l]);
+		}
+	}
+	for (int x = 0; x < n; x++)
+	{
+		const uint8_t *hx = h + (size_t)x * lanes;
+		const uint8_t *gx = pad + (size_t)(x + 2 * r) * lanes;
+		uint8_t *out = dst + x * step;
+		for (int l = 0; l < lanes; l++)
+			out[l] = pick<Max>(hx[l], gx[l]);
+	}
+}
+
+static bool prepare(Image &img)
+{
+	if (!img.buffer())
+		return false;
+	if (img.get_bytespp()==1 && !img.is_grayscale())
+	{
+		if (img.is_view())
+			return false;
+		img.to_rgb();
+	}
+	return true;
+}
+
+template <bool Max>
+static bool extreme_filter(Image &img, int rx, int ry)
+{
+	if (rx < 0 || ry < 0 || !prepare(img))
+		return false;
+	PROFILE_SCOPE(OP_MORPHOLOGY);
+	PROFILE_PIXELS((uint64_t)img.get_width() * img.get_height());
+
+	int w = img.get_width();
+	int h = img.get_height();
+	int bytespp = img.get_bytespp();
+	size_t stride = img.get_stride();
+	uint8_t *data = img.buffer();
+	// A window wider than the image already covers all of it.
+	rx = std::min(rx, w);
+	ry = std::min(ry, h);
+
+	if (rx > 0)
+	{
+		parallel_bands(h, [&](int begin, int end) {
+			std::vector<uint8_t> pad((size_t)(w + 2 * rx) * bytespp);
+			std::vector<uint8_t> hs(pad.size());
+			for (int y = begin; y < end; y++)
+			{
+				uint8_t *row = data + y * stride;
+				if (bytespp == Image::GRAYSCALE)
+					running_extreme<Max, 1>(row, row, bytespp, w, bytespp, rx, &pad[0], &hs[0]);
+				else if (bytespp == Image::RGB)
+					running_extreme<Max, 3>(row, row, bytespp, w, bytespp, rx, &pad[0], &hs[0]);
+				else
+					running_extreme<Max, 4>(row, row, bytespp, w, bytespp, rx, &pad[0], &hs[0]);
+			}
+		});
+	}
+	if (ry > 0)
+	{
+		int line = w * bytespp;
+		int strips = (line + MORPH_STRIP_BYTES - 1) / MORPH_STRIP_BYTES;
+		parallel_bands(strips, [&](int begin, int end) {
+			std::vector<uint8_t> pad((size_t)(h + 2 * ry) * MORPH_STRIP_BYTES);
+			std::vector<uint8_t> hs(pad.size());
+			for (int s = begin; s < end; s++)
+			{
+				int x0 = s * MORPH_STRIP_BYTES;
+				int lanes = line - x0;
+				if (lanes >= MORPH_STRIP_BYTES)
+					running_extreme<Max, MORPH_STRIP_BYTES>(data + x0, data + x0, stride, h, lanes, ry, &pad[0], &hs[0]);
+				else
+					running_extreme<Max, 0>(data + x0, data + x0, stride, h, lanes, ry, &pad[0], &hs[0]);
+			}
+		}, 1);
+	}
+	return true;
+}
+
+bool erode(Image &img, int rx, int ry)
+{
+	return extreme_filter<false>(img, rx, ry);
+}
+
+bool dilate(Image &img, int rx, int ry)
+{
+	return extreme_filter<true>(img, rx, ry);
+}
+
+bool opening(Image &img, int rx, int ry)
+{
+	return erode(img, rx, ry) && dilate(img, rx, ry);
+}
+
+bool closing(Image &img, int rx, int ry)
+{
+	return dilate(img, rx, ry) && erode(img, rx, ry);
+}
+
+// Felzenszwalb and Huttenlocher's lower envelope of parabolas: d[q] becomes
+// the minimum over p of (q - p)^2 + col[p]^2, where col holds the vertical
+// distances of a row and infinite ones are skipped. v and z hold n and n + 1
+// entries. Returns false when every distance is infinite.
+static bool envelope(const uint32_t *col, int n, double *d, int *v, double *z)
+{
+	int k = -1;
+	for (int q = 0; q < n; q++)
+	{
+		if (col[q] == EDT_INF)
+			continue;
+		double fq = (double)col[q] * col[q] + (double)q * q;
+		if (k < 0)
+		{
+			k = 0;
+			v[0] = q;
+			z[0] = -HUGE_VAL;
+			z[1] = HUGE_VAL;
+			continue;
+		}
+		double s;
+		for (;;)
+		{
+			int p = v[k];
+			double fp = (double)col[p] * col[p] + (double)p * p;
+			s = (fq - fp) / (2.0 * (q - p));
+			if (s > z[k])
+				break;
+			k--;
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = HUGE_VAL;
+	}
+	if (k < 0)
+		return false;
+
+	k = 0;
+	for (int q = 0; q < n; q++)
+	{
+		while (z[k + 1] < q)
+			k++;
+		double dx = q - v[k];
+		d[q] = dx * dx + (double)col[v[k]] * col[v[k]];
+	}
+	return true;
+}
+
+// Distances to the foreground of rows, which sign scales, into dist. The
+// first pass finds each pixel's vertical distance to the foreground in its
+// column with a scan down and a scan up, a strip of columns at a time so the
+// scans read whole cache lines; the second takes the lower envelope along
+// each row.
+static void edt(const MaskRows &rows, int w, int h, float sign, ImageF &dist)
+{
+	std::vector<uint32_t> cols((size_t)w * h);
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<uint8_t> fg(w);
+		for (int y = begin; y < end; y++)
+		{
+			rows.read(y, &fg[0]);
+			uint32_t *col = &cols[(size_t)y * w];
+			for (int x = 0; x < w; x++)
+				col[x] = fg[x] ? 0 : EDT_INF;
+		}
+	});
+	int strips = (w + EDT_STRIP_COLS - 1) / EDT_STRIP_COLS;
+	parallel_bands(strips, [&](int begin, int end) {
+		int x0 = begin * EDT_STRIP_COLS;
+		int x1 = std::min(w, end * EDT_STRIP_COLS);
+		for (int y = 1; y < h; y++)
+		{
+			uint32_t *cur = &cols[(size_t)y * w];
+			const uint32_t *up = cur - w;
+			for (int x = x0; x < x1; x++)
+				if (up[x] != EDT_INF && up[x] + 1 < cur[x])
+					cur[x] = up[x] + 1;
+		}
+		for (int y = h - 2; y >= 0; y--)
+		{
+			uint32_t *cur = &cols[(size_t)y * w];
+			const uint32_t *down = cur + w;
+			for (int x = x0; x < x1; x++)
+				if (down[x] != EDT_INF && down[x] + 1 < cur[x])
+					cur[x] = down[x] + 1;
+		}
+	}, 1);
+
+	parallel_bands(h, [&](int begin, int end) {
+		std::vector<double> d(w);
+		std::vector<int> v(w);
+		std::vector<double> z(w + 1);
+		for (int y = begin; y < end; y++)
+		{
+			float *out = dist.row(y);
+			if (!envelope(&cols[(size_t)y * w], w, &d[0], &v[0], &z[0]))
+			{
+				for (int x = 0; x < w; x++)
+					out[x] = sign * HUGE_VALF;
+				continue;
+			}
+			for (int x = 0; x < w; x++)
+				out[x] = sign * (float)sqrt(d[x]);
+		}
+	});
+}
+
+bool distance_transform(const Image &mask, ImageF &dist, int threshold, bool dark)
+{
+	if (!mask.buffer())
+		return false;
+	PROFILE_SCOPE(OP_DISTANCE);
+	int w = mask.get_width();
+	int h = mask.get_height();
+	PROFILE_PIXELS((uint64_t)w * h);
+	dist = ImageF(h, w, 1);
+	edt(MaskRows(mask, threshold, dark), w, h, 1.0f, dist);
+	return true;
+}
+
+bool signed_distance(const Image &mask, ImageF &sdf, int threshold, bool dark)
+{
+	if (!mask.buffer())
+		return false;
+	PROFILE_SCOPE(OP_DISTANCE);
+	int w = mask.get_width();
+	int h = mask.get_height();
+	PROFILE_PIXELS((uint64_t)w * h);
+	sdf = ImageF(h, w, 1);
+	ImageF inside(h, w, 1);
+	edt(MaskRows(mask, threshold, dark), w, h, 1.0f, sdf);
+	edt(MaskRows(mask, threshold, !dark), w, h, -1.0f, inside);
+	parallel_bands(h, [&](int begin, int end) {
+		for (int y = begin; y < end; y++)
+		{
+			float *out = sdf.row(y);
+			const float *in = inside.row(y);
+			// One of the two is always zero.
+			for (int x = 0; x < w; x++)
+				out[x] += in[x];
+		}
+	});
+	return true;
+}
@@ -0,0 +1,29 @@
+#ifndef __MORPHOLOGY_H__
+#define __MORPHOLOGY_H__
+
+#include "Image.h"
+#include "ImageT.h"
+
+// Morphology and distance transforms for masks and other 8-bit images. All
+// of them cost the same per pixel whatever the radius or distance.
+
+// Minimum (erode) or maximum (dilate) of every channel over the
+// (2 * rx + 1) x (2 * ry + 1) rectangle around each pixel, clipped to the
+// image. Indexed images with a colour palette are expanded to RGB first.
+bool erode(Image &img, int rx, int ry);
+bool dilate(Image &img, int rx, int ry);
+// Erode then dilate, which removes specks smaller than the rectangle, and
+// dilate then erode, which fills holes smaller than it.
+bool opening(Image &img, int rx, int ry);
+bool closing(Image &img, int rx, int ry);
+
+// Exact Euclidean distance from each pixel centre to the nearest foreground
+// pixel of mask, by the rule in Region.h; 0 on the foreground and infinite
+// when there is none.
+bool distance_transform(const Image &mask, ImageF &dist, int threshold = 128, bool dark = false);
+// Distance to the foreground outside it, minus the distance to the
+// background inside it, so the foreground is negative and the edge lies
+// between -1 and 1.
+bool signed_distance(const Image &mask, ImageF &sdf, int threshold = 128, bool dark = false);
+
+#endif //__MORPHOLOGY_H__
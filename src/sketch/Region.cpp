@@ -0,0 +1,283 @@
+#include <stdint.h>
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+
+#include "Parallel.h"
+#include "Profile.h"
+#include "Region.h"
+
+// Two-pass labelling with union-find. Each band of rows is labelled on its
+// own thread with provisional labels from a range of its own, so bands never
+// touch each other's union-find entries. The seams between bands are then
+// joined on the calling thread, the provisional labels flattened to final
+// ones and every pixel relabelled, again by band.
+//
+// Unions always make the smaller label the parent, so a parent is never
+// larger than its child. Flattening can then resolve labels in increasing
+// order with a single lookup each, and the final labels follow the order of
+// each component's first pixel.
+
+struct Bounds
+{
+	int x0, y0, x1, y1;
+	uint64_t area;
+
+	Bounds(int x, int y) : x0(x), y0(y), x1(x), y1(y), area(1)
+	{
+	}
+
+	void add(int x, int y)
+	{
+		x0 = std::min(x0, x);
+		x1 = std::max(x1, x);
+		y1 = std::max(y1, y);
+		area++;
+	}
+
+	void merge(const Bounds &b)
+	{
+		x0 = std::min(x0, b.x0);
+		y0 = std::min(y0, b.y0);
+		x1 = std::max(x1, b.x1);
+		y1 = std::max(y1, b.y1);
+		area += b.area;
+	}
+};
+
+struct Band
+{
+	int begin;
+	int end;
+	uint32_t base;					// First provisional label
+	std::vector<Bounds> bounds;		// Per provisional label from base
+};
+
+static uint32_t find(uint32_t *parent, uint32_t l)
+{
+	while (parent[l] != l)
+	{
+		parent[l] = parent[parent[l]];
+		l = parent[l];
+	}
+	return l;
+}
+
+static uint32_t unite(uint32_t *parent, uint32_t a, uint32_t b)
+{
+	a = find(parent, a);
+	b = find(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else
+		parent[a] = b;
+	return std::min(a, b);
+}
+
+MaskRows::MaskRows(const Image &mask, int threshold, bool dark) : mask(mask), threshold(threshold), dark(dark)
+{
+	if (mask.get_bytespp() != 1)
+		return;
+	bool indexed = !mask.is_grayscale();
+	const uint8_t *pal = mask.palette_buffer();
+	int entries = mask.get_palette_size() / RGBAQUAD;
+	for (int i = 0; i < NUM_COLORS; i++)
+	{
+		int level = i;
+		if (indexed)
+		{
+			const uint8_t *entry = pal + i * RGBAQUAD;
+			level = i < entries ? (entry[0] + entry[1] + entry[2]) / 3 : 0;
+		}
+		lut[i] = (level >= threshold) != dark;
+	}
+}
+
+// Wider pixels compare the sum of their colour channels with 3 * threshold,
+// which is the same test as their mean without the division.
+void MaskRows::read(int y, uint8_t *fg) const
+{
+	int w = mask.get_width();
+	int bytespp = mask.get_bytespp();
+	const uint8_t *row = mask.buffer() + (size_t)y * mask.get_stride();
+	if (bytespp == 1)
+	{
+		for (int x = 0; x < w; x++)
+			fg[x] = lut[row[x]];
+		return;
+	}
+	int limit = 3 * threshold;
+	for (int x = 0; x < w; x++, row += bytespp)
+		fg[x] = (row[0] + row[1] + row[2] >= limit) != dark;
+}
+
+// First pass over one band. up is the labelled row above within the band.
+static void label_band(const MaskRows &rows, int w, bool diagonal, uint32_t *labels, uint32_t *parent, Band &band)
+{
+	std::vector<uint8_t> fg(w);
+	uint32_t next = band.base;
+
+	for (int y = band.begin; y < band.end; y++)
+	{
+		rows.read(y, &fg[0]);
+		uint32_t *cur = labels + (size_t)y * w;
+		const uint32_t *up = y > band.begin ? cur - w : NULL;
+		for (int x = 0; x < w; x++)
+		{
+			if (!fg[x])
+			{
+				cur[x] = 0;
+				continue;
+			}
+
+			uint32_t left = x > 0 ? cur[x - 1] : 0;
+			uint32_t above = up ? up[x] : 0;
+			uint32_t l;
+			if (above)
+			{
+				// Whatever else touches this pixel from the row above or the
+				// left also touches above, so is already joined to it.
+				l = above;
+				if (left && !diagonal)
+					l = unite(parent, above, left);
+			}
+			else if (!diagonal)
+			{
+				l = left;
+			}
+			else
+			{
+				uint32_t above_left = up && x > 0 ? up[x - 1] : 0;
+				uint32_t above_right = up && x + 1 < w ? up[x + 1] : 0;
+				l = left ? left : above_left;
+				if (above_right)
+					l = l ? unite(parent, l, above_right) : above_right;
+			}
+
+			if (!l)
+			{
+				l = next++;
+				parent[l] = l;
+				band.bounds.push_back(Bounds(x, y));
+			}
+			else
+			{
+				band.bounds[l - band.base].add(x, y);
+			}
+			cur[x] = l;
+		}
+	}
+}
+
+bool label_components(const Image &mask, Labels &result, const LabelOptions &options)
+{
+	try
+	{
+		if (!mask.buffer())
+			throw "Nothing to label";
+		int w = mask.get_width();
+		int h = mask.get_height();
+		int bytespp = mask.get_bytespp();
+		if (bytespp != Image::GRAYSCALE && bytespp != Image::RGB && bytespp != Image::RGBA)
+			throw "Unsupported pixel format";
+
+		// A run starts at most every other pixel, so no band needs more than
+		// (w + 1) / 2 new labels per row.
+		uint64_t per_row = (w + 1) / 2;
+		if (per_row * h + 1 > UINT32_MAX)
+			throw "Image too large to label";
+		PROFILE_SCOPE(OP_LABEL);
+		PROFILE_PIXELS((uint64_t)w * h);
+
+		result.width = w;
+		result.height = h;
+		result.labels.assign((size_t)w * h, 0);
+		result.components.clear();
+		std::vector<uint32_t> parent(per_row * h + 1, 0);
+		MaskRows rows(mask, options.threshold, options.dark);
+
+		std::vector<Band> bands;
+		std::mutex lock;
+		parallel_bands(h, [&](int begin, int end) {
+			Band band;
+			band.begin = begin;
+			band.end = end;
+			band.base = 1 + per_row * begin;
+			label_band(rows, w, options.diagonal, &result.labels[0], &parent[0], band);
+			std::lock_guard<std::mutex> guard(lock);
+			bands.push_back(std::move(band));
+		});
+		std::sort(bands.begin(), bands.end(), [](const Band &a, const Band &b) { return a.begin < b.begin; });
+
+		// Join each band's first row to the last row of the band above.
+		uint32_t *labels = &result.labels[0];
+		for (size_t b = 1; b < bands.size(); b++)
+		{
+			uint32_t *cur = labels + (size_t)bands[b].begin * w;
+			const uint32_t *up = cur - w;
+			for (int x = 0; x < w; x++)
+			{
+				if (!cur[x])
+					continue;
+				if (up[x])
+					unite(&parent[0], cur[x], up[x]);
+				else if (options.diagonal)
+				{
+					if (x > 0 && up[x - 1])
+						unite(&parent[0], cur[x], up[x - 1]);
+					if (x + 1 < w && up[x + 1])
+						unite(&parent[0], cur[x], up[x + 1]);
+				}
+			}
+		}
+
+		// parent[l] becomes the final label of l.
+		uint32_t count = 0;
+		for (size_t b = 0; b < bands.size(); b++)
+		{
+			uint32_t first = bands[b].base;
+			uint32_t last = first + bands[b].bounds.size();
+			for (uint32_t l = first; l < last; l++)
+				parent[l] = parent[l] < l ? parent[parent[l]] : ++count;
+		}
+
+		std::vector<Bounds> merged(count, Bounds(0, 0));
+		std::vector<bool> seen(count, false);
+		for (size_t b = 0; b < bands.size(); b++)
+		{
+			for (size_t i = 0; i < bands[b].bounds.size(); i++)
+			{
+				uint32_t c = parent[bands[b].base + i] - 1;
+				if (seen[c])
+					merged[c].merge(bands[b].bounds[i]);
+				else
+					merged[c] = bands[b].bounds[i];
+				seen[c] = true;
+			}
+		}
+		result.components.resize(count);
+		for (uint32_t c = 0; c < count; c++)
+		{
+			Component &comp = result.components[c];
+			comp.x = merged[c].x0;
+			comp.y = merged[c].y0;
+			comp.width = merged[c].x1 - merged[c].x0 + 1;
+			comp.height = merged[c].y1 - merged[c].y0 + 1;
+			comp.area = merged[c].area;
+		}
+
+		const uint32_t *relabel = &parent[0];
+		parallel_bands(h, [&](int begin, int end) {
+			uint32_t *p = labels + (size_t)begin * w;
+			uint32_t *stop = labels + (size_t)end * w;
+			for (; p < stop; p++)
+				*p = relabel[*p];
+		});
+		return true;
+	}
+	catch (const char* msg)
+	{
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
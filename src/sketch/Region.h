@@ -0,0 +1,67 @@
+#ifndef __REGION_H__
+#define __REGION_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Image.h"
+
+// Region operations on masks. A pixel of a mask is foreground when its
+// level, the mean of its colour channels (palette colours for indexed
+// images, alpha ignored), is at least threshold; or below it for dark masks
+// such as dots.bmp.
+
+// Reads a mask row by row as foreground flags of 0 or 1.
+class MaskRows
+{
+	const Image &mask;
+	int threshold;
+	bool dark;
+	bool lut[NUM_COLORS];		// For 8-bit masks, by index
+
+public:
+	MaskRows(const Image &mask, int threshold, bool dark);
+
+	void read(int y, uint8_t *fg) const;
+};
+
+struct LabelOptions
+{
+	int threshold;
+	bool dark;			// Foreground is below threshold
+	bool diagonal;		// 8-connected rather than 4-connected
+
+	LabelOptions() : threshold(128), dark(false), diagonal(true)
+	{
+	}
+};
+
+struct Component
+{
+	int x, y;				// Top left of the bounding box
+	int width, height;
+	uint64_t area;			// Pixels in the component
+};
+
+struct Labels
+{
+	int width;
+	int height;
+	std::vector<uint32_t> labels;			// Per pixel, row by row; 0 for background
+	std::vector<Component> components;		// Label l is components[l - 1]
+
+	Labels() : width(0), height(0)
+	{
+	}
+
+	uint32_t at(int x, int y) const
+	{
+		return labels[(size_t)y * width + x];
+	}
+};
+
+// Labels components in the order their first pixels appear in a top-down
+// scan, whatever the number of threads.
+bool label_components(const Image &mask, Labels &labels, const LabelOptions &options = LabelOptions());
+
+#endif //__REGION_H__
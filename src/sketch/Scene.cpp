@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "Composite.h"
+#include "Scene.h"
+
+#define MAX_TOKENS          12
+
+static int parse_int(const char *token, int lo, int hi)
+{
+	char *end;
+	long v = strtol(token, &end, 10);
+	if (end == token || *end != '\0')
+		throw "expected a number";
+	if (v < lo || v > hi)
+		throw "number out of range";
+	return (int)v;
+}
+
+// r g b [a] starting at tokens[first].
+static Colour parse_colour(char **tokens, int count, int first)
+{
+	if (count < first + 3 || count > first + 4)
+		throw "expected r g b [a]";
+	uint8_t a = count == first + 4 ? parse_int(tokens[first + 3], 0, 255) : 255;
+	return Colour(parse_int(tokens[first], 0, 255), parse_int(tokens[first + 1], 0, 255),
+	              parse_int(tokens[first + 2], 0, 255), a);
+}
+
+static void parse_line(char **tokens, int count, Scene &scene)
+{
+	const char *cmd = tokens[0];
+	if (strcmp(cmd, "canvas") == 0)
+	{
+		if (scene.bytespp)
+			throw "canvas given twice";
+		if (count != 4 && count != 7 && count != 8)
+			throw "expected canvas <width> <height> <bytespp> [r g b [a]]";
+		scene.width = parse_int(tokens[1], 1, SCENE_MAX_SIDE);
+		scene.height = parse_int(tokens[2], 1, SCENE_MAX_SIDE);
+		scene.bytespp = parse_int(tokens[3], 1, 4);
+		if (scene.bytespp == 2)
+			throw "bytespp must be 1, 3 or 4";
+		scene.background = count > 4 ? parse_colour(tokens, count, 4) : Colour(0, 0, 0, 255);
+		return;
+	}
+	if (!scene.bytespp)
+		throw "canvas must come first";
+
+	SceneOp op;
+	memset(op.v, 0, sizeof(op.v));
+	op.image = -1;
+	op.opacity = 1.0f;
+	if (strcmp(cmd, "line") == 0)
+	{
+		op.kind = SceneOp::LINE;
+		if (count < 8)
+			throw "expected line <x0> <y0> <x1> <y1> <r> <g> <b> [a]";
+		for (int i = 0; i < 4; i++)
+			op.v[i] = parse_int(tokens[1 + i], -SCENE_MAX_SIDE, 2 * SCENE_MAX_SIDE);
+		op.colour = parse_colour(tokens, count, 5);
+	}
+	else if (strcmp(cmd, "triangle") == 0)
+	{
+		op.kind = SceneOp::TRIANGLE;
+		if (count < 10)
+			throw "expected triangle <x0> <y0> <x1> <y1> <x2> <y2> <r> <g> <b> [a]";
+		for (int i = 0; i < 6; i++)
+			op.v[i] = parse_int(tokens[1 + i], -SCENE_MAX_SIDE, 2 * SCENE_MAX_SIDE);
+		op.colour = parse_colour(tokens, count, 7);
+	}
+	else if (strcmp(cmd, "image") == 0)
+	{
+		op.kind = SceneOp::IMAGE;
+		if (count != 4 && count != 5)
+			throw "expected image <path> <x> <y> [opacity]";
+		if (scene.bytespp == Image::GRAYSCALE)
+			throw "images need an RGB or RGBA canvas";
+		op.v[0] = parse_int(tokens[2], -SCENE_MAX_SIDE, 2 * SCENE_MAX_SIDE);
+		op.v[1] = parse_int(tokens[3], -SCENE_MAX_SIDE, 2 * SCENE_MAX_SIDE);
+		if (count == 5)
+		{
+			char *end;
+			op.opacity = strtof(tokens[4], &end);
+			if (end == tokens[4] || *end != '\0' || !(op.opacity >= 0.0f && op.opacity <= 1.0f))
+				throw "opacity must be between 0 and 1";
+		}
+		op.image = (int)scene.images.size();
+		scene.images.push_back(tokens[1]);
+	}
+	else
+	{
+		throw "unknown command";
+	}
+	scene.ops.push_back(op);
+}
+
+// Splits line in place on spaces and tabs. A line with more than MAX_TOKENS
+// tokens counts as one more, which every command rejects.
+static int tokenize(char *line, char **tokens)
+{
+	int count = 0;
+	char *p = line;
+	for (;;)
+	{
+		while (*p == ' ' || *p == '\t' || *p == '\r')
+			p++;
+		if (!*p)
+			return count;
+		if (count == MAX_TOKENS)
+			return count + 1;
+		tokens[count++] = p;
+		while (*p && *p != ' ' && *p != '\t' && *p != '\r')
+			p++;
+		if (*p)
+			*p++ = '\0';
+	}
+}
+
+bool parse_scene(const char *text, size_t len, Scene &scene, std::string &error)
+{
+	scene = Scene();
+	std::string line;
+	int number = 0;
+	const char *end = text + len;
+	for (const char *p = text; p < end; )
+	{
+		const char *eol = (const char *)memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		line.assign(p, eol);
+		p = eol + 1;
+		number++;
+
+		char *tokens[MAX_TOKENS];
+		int count = tokenize(&line[0], tokens);
+		if (count == 0 || tokens[0][0] == '#')
+			continue;
+
+		try
+		{
+			parse_line(tokens, count, scene);
+		}
+		catch (const char* msg)
+		{
+			error = "line " + std::to_string(number) + ": " + msg;
+			return false;
+		}
+	}
+	if (!scene.bytespp)
+	{
+		error = "no canvas";
+		return false;
+	}
+	return true;
+}
+
+bool render_scene(const Scene &scene, Sketch &canvas, std::string &error)
+{
+	if (canvas.get_width() != scene.width || canvas.get_height() != scene.height || canvas.get_bytespp() != scene.bytespp)
+	{
+		error = "canvas does not match the scene";
+		return false;
+	}
+
+	canvas.fill(scene.background);
+	for (size_t i = 0; i < scene.ops.size(); i++)
+	{
+		const SceneOp &op = scene.ops[i];
+		switch (op.kind)
+		{
+		case SceneOp::LINE:
+			canvas.draw_line(op.v[0], op.v[1], op.v[2], op.v[3], op.colour);
+			break;
+		case SceneOp::TRIANGLE:
+			canvas.draw_triangle(Vector2i(op.v[0], op.v[1]), Vector2i(op.v[2], op.v[3]), Vector2i(op.v[4], op.v[5]), op.colour);
+			break;
+		case SceneOp::IMAGE:
+		{
+			Image image;
+			image.read_bmp(scene.images[op.image].c_str());
+			// Not buffer(), which would copy the cached pixels.
+			if (!image.get_width())
+			{
+				error = "could not read " + scene.images[op.image];
+				return false;
+			}
+			composite_over(canvas, image, op.v[0], op.v[1], op.opacity);
+			break;
+		}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <string>
+#include <vector>
+
+#include "Sketch.h"
+
+#define SCENE_MAX_SIDE      16384
+
+// A small scene description: a canvas and a list of primitives drawn onto it
+// in order. The text form has one command per line; blank lines and lines
+// starting with # are skipped, and alpha defaults to 255.
+//
+//   canvas <width> <height> <bytespp> [r g b [a]]    background, default black
+//   line <x0> <y0> <x1> <y1> <r> <g> <b> [a]
+//   triangle <x0> <y0> <x1> <y1> <x2> <y2> <r> <g> <b> [a]
+//   image <path> <x> <y> [opacity]                   composited over the canvas
+//
+// canvas must come first. Images need an RGB or RGBA canvas. Canvas sides
+// are at most SCENE_MAX_SIDE, and coordinates lie within one canvas side of
+// the largest canvas.
+
+struct SceneOp
+{
+	enum Kind
+	{
+		LINE,
+		TRIANGLE,
+		IMAGE
+	};
+
+	Kind kind;
+	int v[6];				// Vertex coordinates, or the image position in v[0], v[1]
+	Colour colour;
+	int image;			// Index into Scene::images
+	float opacity;
+};
+
+struct Scene
+{
+	int width;
+	int height;
+	int bytespp;
+	Colour background;
+	std::vector<SceneOp> ops;
+	std::vector<std::string> images;
+
+	Scene() : width(0), height(0), bytespp(0)
+	{
+	}
+};
+
+// Parses a text scene. On failure returns false and describes the first bad
+// line in error.
+bool parse_scene(const char *text, size_t len, Scene &scene, std::string &error);
+
+// Fills canvas with the background and draws every primitive. The canvas
+// must already have the scene's size and format.
+bool render_scene(const Scene &scene, Sketch &canvas, std::string &error);
+
+#endif //__SCENE_H__
@@ -0,0 +1,316 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <unordered_map>
+
+#include "Composite.h"
+#include "SceneFile.h"
+
+SceneFile::SceneFile() : data(NULL), size(0)
+{
+}
+
+bool SceneFile::open(const char *filename, std::string &error)
+{
+	data = NULL;
+	size = 0;
+	if (!file.open(filename))
+	{
+		error = std::string("could not map ") + filename;
+		return false;
+	}
+	return load(file.bytes(), file.length(), error);
+}
+
+// Checks that a section lies inside the file after the header, aligned for
+// entries of the given size.
+static void check_section(const SceneFileSection &s, size_t entry, const SceneFileHeader &h, size_t size)
+{
+	if (s.offset % 4 != 0 || s.offset < h.header_size)
+		throw "misplaced section";
+	if ((uint64_t)s.offset + (uint64_t)s.count * entry > size)
+		throw "section runs past the end of the file";
+}
+
+static void check_coordinate(int32_t v)
+{
+	if (v < -SCENE_MAX_SIDE || v > 2 * SCENE_MAX_SIDE)
+		throw "coordinate out of range";
+}
+
+bool SceneFile::load(const uint8_t *bytes, size_t len, std::string &error)
+{
+	data = NULL;
+	size = 0;
+	try
+	{
+		if ((uintptr_t)bytes % 4 != 0)
+			throw "scene data must be 4-byte aligned";
+		if (len < sizeof(SceneFileHeader))
+			throw "too short for a scene file";
+		const SceneFileHeader &h = *(const SceneFileHeader *)bytes;
+		if (h.magic != SCENE_FILE_MAGIC)
+			throw "not a scene file";
+		if (h.major != SCENE_FILE_MAJOR)
+			throw "unsupported scene file version";
+		if (h.header_size < sizeof(SceneFileHeader) || h.header_size % 4 != 0 || h.file_size > len || h.header_size > h.file_size)
+			throw "bad header size";
+		size_t n = h.file_size;
+
+		if (h.width < 1 || h.width > SCENE_MAX_SIDE || h.height < 1 || h.height > SCENE_MAX_SIDE)
+			throw "canvas size out of range";
+		if (h.bytespp != Image::GRAYSCALE && h.bytespp != Image::RGB && h.bytespp != Image::RGBA)
+			throw "bytespp must be 1, 3 or 4";
+
+		check_section(h.vertices, 2 * sizeof(int32_t), h, n);
+		check_section(h.indices, sizeof(uint32_t), h, n);
+		check_section(h.commands, sizeof(SceneFileCommand), h, n);
+		check_section(h.colours, sizeof(uint32_t), h, n);
+		check_section(h.images, sizeof(SceneFileImage), h, n);
+		check_section(h.strings, 1, h, n);
+
+		// Everything render_scene follows is checked once here, so drawing
+		// needs no bounds checks of its own.
+		const int32_t *vertices = (const int32_t *)(bytes + h.vertices.offset);
+		for (uint32_t i = 0; i < 2 * h.vertices.count; i++)
+			check_coordinate(vertices[i]);
+
+		const uint32_t *indices = (const uint32_t *)(bytes + h.indices.offset);
+		for (uint32_t i = 0; i < h.indices.count; i++)
+			if (indices[i] >= h.vertices.count)
+				throw "vertex index out of range";
+
+		const char *strings = (const char *)(bytes + h.strings.offset);
+		if (h.strings.count > 0 && strings[h.strings.count - 1] != '\0')
+			throw "unterminated image path";
+
+		const SceneFileImage *images = (const SceneFileImage *)(bytes + h.images.offset);
+		for (uint32_t i = 0; i < h.images.count; i++)
+		{
+			if (images[i].path >= h.strings.count)
+				throw "image path out of range";
+			check_coordinate(images[i].x);
+			check_coordinate(images[i].y);
+			if (!(images[i].opacity >= 0.0f && images[i].opacity <= 1.0f))
+				throw "opacity must be between 0 and 1";
+		}
+
+		const SceneFileCommand *commands = (const SceneFileCommand *)(bytes + h.commands.offset);
+		for (uint32_t i = 0; i < h.commands.count; i++)
+		{
+			const SceneFileCommand &c = commands[i];
+			switch (c.kind)
+			{
+			case SceneOp::LINE:
+			case SceneOp::TRIANGLE:
+			{
+				uint64_t used = c.kind == SceneOp::LINE ? 2 : 3;
+				if ((uint64_t)c.first + used > h.indices.count)
+					throw "command indices out of range";
+				if (c.colour >= h.colours.count)
+					throw "colour index out of range";
+				break;
+			}
+			case SceneOp::IMAGE:
+				if (c.first >= h.images.count)
+					throw "image index out of range";
+				if (h.bytespp == Image::GRAYSCALE)
+					throw "images need an RGB or RGBA canvas";
+				break;
+			default:
+				throw "unknown command";
+			}
+		}
+
+		data = bytes;
+		size = n;
+		return true;
+	}
+	catch (const char* msg)
+	{
+		error = msg;
+		return false;
+	}
+}
+
+template <typename T>
+static void put(std::vector<uint8_t> &bytes, const SceneFileSection &s, const std::vector<T> &items)
+{
+	if (!items.empty())
+		memcpy(&bytes[s.offset], &items[0], items.size() * sizeof(T));
+}
+
+static SceneFileSection place(uint32_t &offset, size_t count, size_t entry)
+{
+	SceneFileSection s;
+	s.offset = offset;
+	s.count = count;
+	offset += (count * entry + 3) & ~(size_t)3;
+	return s;
+}
+
+void encode_scene_file(const Scene &scene, std::vector<uint8_t> &bytes)
+{
+	std::vector<int32_t> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<SceneFileCommand> commands;
+	std::vector<uint32_t> colours;
+	std::vector<SceneFileImage> images;
+	std::string strings;
+
+	std::unordered_map<uint64_t, uint32_t> vertex_ids;
+	std::unordered_map<uint32_t, uint32_t> colour_ids;
+	std::unordered_map<std::string, uint32_t> path_ids;
+
+	commands.reserve(scene.ops.size());
+	for (size_t i = 0; i < scene.ops.size(); i++)
+	{
+		const SceneOp &op = scene.ops[i];
+		SceneFileCommand c;
+		c.kind = op.kind;
+		c.colour = 0;
+		if (op.kind == SceneOp::IMAGE)
+		{
+			const std::string &path = scene.images[op.image];
+			auto found = path_ids.find(path);
+			if (found == path_ids.end())
+			{
+				found = path_ids.insert(std::make_pair(path, (uint32_t)strings.size())).first;
+				strings.append(path.c_str(), path.size() + 1);
+			}
+			SceneFileImage image;
+			image.path = found->second;
+			image.x = op.v[0];
+			image.y = op.v[1];
+			image.opacity = op.opacity;
+			c.first = images.size();
+			images.push_back(image);
+		}
+		else
+		{
+			int used = op.kind == SceneOp::LINE ? 2 : 3;
+			c.first = indices.size();
+			for (int k = 0; k < used; k++)
+			{
+				uint64_t key = (uint64_t)(uint32_t)op.v[2 * k] << 32 | (uint32_t)op.v[2 * k + 1];
+				auto found = vertex_ids.insert(std::make_pair(key, (uint32_t)(vertices.size() / 2)));
+				if (found.second)
+				{
+					vertices.push_back(op.v[2 * k]);
+					vertices.push_back(op.v[2 * k + 1]);
+				}
+				indices.push_back(found.first->second);
+			}
+			auto found = colour_ids.insert(std::make_pair(op.colour.val, (uint32_t)colours.size()));
+			if (found.second)
+				colours.push_back(op.colour.val);
+			c.colour = found.first->second;
+		}
+		commands.push_back(c);
+	}
+
+	SceneFileHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = SCENE_FILE_MAGIC;
+	h.major = SCENE_FILE_MAJOR;
+	h.minor = SCENE_FILE_MINOR;
+	h.header_size = sizeof(h);
+	h.width = scene.width;
+	h.height = scene.height;
+	h.bytespp = scene.bytespp;
+	h.background = scene.background.val;
+
+	uint32_t offset = sizeof(h);
+	h.vertices = place(offset, vertices.size() / 2, 2 * sizeof(int32_t));
+	h.indices = place(offset, indices.size(), sizeof(uint32_t));
+	h.commands = place(offset, commands.size(), sizeof(SceneFileCommand));
+	h.colours = place(offset, colours.size(), sizeof(uint32_t));
+	h.images = place(offset, images.size(), sizeof(SceneFileImage));
+	h.strings = place(offset, strings.size(), 1);
+	h.file_size = offset;
+
+	bytes.assign(offset, 0);
+	memcpy(&bytes[0], &h, sizeof(h));
+	put(bytes, h.vertices, vertices);
+	put(bytes, h.indices, indices);
+	put(bytes, h.commands, commands);
+	put(bytes, h.colours, colours);
+	put(bytes, h.images, images);
+	if (!strings.empty())
+		memcpy(&bytes[h.strings.offset], strings.data(), strings.size());
+}
+
+bool write_scene_file(const Scene &scene, const char *filename)
+{
+	std::vector<uint8_t> bytes;
+	encode_scene_file(scene, bytes);
+
+	FILE *fp = NULL;
+	try
+	{
+		fp = fopen(filename, "wb");
+		if (!fp)
+			throw "Could not open file";
+		if (fwrite(&bytes[0], bytes.size(), 1, fp) != 1)
+		{
+			fclose(fp);
+			throw "Could not write data to file";
+		}
+		fclose(fp);
+		return true;
+	}
+	catch (const char* msg)
+	{
+		std::cerr << msg << std::endl;
+		return false;
+	}
+}
+
+bool render_scene(const SceneFile &scene, Sketch &canvas, std::string &error)
+{
+	const SceneFileHeader &h = scene.header();
+	if (canvas.get_width() != h.width || canvas.get_height() != h.height || canvas.get_bytespp() != h.bytespp)
+	{
+		error = "canvas does not match the scene";
+		return false;
+	}
+
+	const int32_t *vertices = scene.vertices();
+	const uint32_t *indices = scene.indices();
+	const SceneFileCommand *commands = scene.commands();
+	const uint32_t *colours = scene.colours();
+	canvas.fill(Colour(h.background, 4));
+	for (uint32_t i = 0; i < h.commands.count; i++)
+	{
+		const SceneFileCommand &c = commands[i];
+		const uint32_t *v = indices + c.first;
+		switch (c.kind)
+		{
+		case SceneOp::LINE:
+			canvas.draw_line(vertices[2 * v[0]], vertices[2 * v[0] + 1], vertices[2 * v[1]], vertices[2 * v[1] + 1],
+			                 Colour(colours[c.colour], 4));
+			break;
+		case SceneOp::TRIANGLE:
+			canvas.draw_triangle(Vector2i(vertices[2 * v[0]], vertices[2 * v[0] + 1]),
+			                     Vector2i(vertices[2 * v[1]], vertices[2 * v[1] + 1]),
+			                     Vector2i(vertices[2 * v[2]], vertices[2 * v[2] + 1]), Colour(colours[c.colour], 4));
+			break;
+		case SceneOp::IMAGE:
+		{
+			const SceneFileImage &ref = scene.images()[c.first];
+			Image image;
+			image.read_bmp(scene.image_path(ref));
+			// Not buffer(), which would copy the cached pixels.
+			if (!image.get_width())
+			{
+				error = std::string("could not read ") + scene.image_path(ref);
+				return false;
+			}
+			composite_over(canvas, image, ref.x, ref.y, ref.opacity);
+			break;
+		}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,133 @@
+#ifndef __SCENE_FILE_H__
+#define __SCENE_FILE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "Scene.h"
+
+// Flat binary form of a Scene, laid out so a mapped file can be drawn from
+// in place: no parsing, and no allocation beyond decoding referenced images.
+// All fields are little-endian and every section starts on a 4-byte boundary.
+//
+//   SceneFileHeader
+//   vertices    int32_t x, y per vertex
+//   indices     uint32_t into vertices, 2 per line and 3 per triangle
+//   commands    SceneFileCommand, drawn in order
+//   colours     uint32_t r | g << 8 | b << 16 | a << 24
+//   images      SceneFileImage
+//   strings     NUL-terminated image paths
+//
+// Each section is given by its offset from the start of the file and its
+// count of entries (bytes, for strings). Readers reject other major
+// versions; a newer minor version may grow the header, which header_size
+// covers.
+
+#define SCENE_FILE_MAGIC    0x4e435350u		// "PSCN"
+#define SCENE_FILE_MAJOR    1
+#define SCENE_FILE_MINOR    0
+
+struct SceneFileSection
+{
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct SceneFileHeader
+{
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	uint32_t header_size;
+	uint32_t file_size;
+	int32_t width;
+	int32_t height;
+	int32_t bytespp;
+	uint32_t background;		// Colour, not an index
+	SceneFileSection vertices;
+	SceneFileSection indices;
+	SceneFileSection commands;
+	SceneFileSection colours;
+	SceneFileSection images;
+	SceneFileSection strings;
+};
+
+struct SceneFileCommand
+{
+	uint32_t kind;			// SceneOp::Kind
+	uint32_t first;			// First index for lines and triangles, else the image
+	uint32_t colour;		// Into colours; unused for images
+};
+
+struct SceneFileImage
+{
+	uint32_t path;			// Into strings
+	int32_t x;
+	int32_t y;
+	float opacity;
+};
+
+// A validated binary scene, either mapped from a file or borrowed from a
+// caller's buffer, which must then outlive it.
+class SceneFile
+{
+	MappedFile file;
+	const uint8_t *data;
+	size_t size;
+
+	SceneFile(const SceneFile &);
+	SceneFile &operator=(const SceneFile &);
+
+	template <typename T>
+	const T *section(const SceneFileSection &s) const
+	{
+		return (const T *)(data + s.offset);
+	}
+
+public:
+	SceneFile();
+
+	bool open(const char *filename, std::string &error);
+	bool load(const uint8_t *bytes, size_t len, std::string &error);
+
+	const SceneFileHeader &header() const
+	{
+		return *(const SceneFileHeader *)data;
+	}
+	const int32_t *vertices() const
+	{
+		return section<int32_t>(header().vertices);
+	}
+	const uint32_t *indices() const
+	{
+		return section<uint32_t>(header().indices);
+	}
+	const SceneFileCommand *commands() const
+	{
+		return section<SceneFileCommand>(header().commands);
+	}
+	const uint32_t *colours() const
+	{
+		return section<uint32_t>(header().colours);
+	}
+	const SceneFileImage *images() const
+	{
+		return section<SceneFileImage>(header().images);
+	}
+	const char *image_path(const SceneFileImage &image) const
+	{
+		return section<char>(header().strings) + image.path;
+	}
+};
+
+// Lays out scene in the binary form. Repeated vertices and colours are
+// stored once.
+void encode_scene_file(const Scene &scene, std::vector<uint8_t> &bytes);
+bool write_scene_file(const Scene &scene, const char *filename);
+
+// As render_scene, drawing straight from the file's arrays.
+bool render_scene(const SceneFile &scene, Sketch &canvas, std::string &error);
+
+#endif //__SCENE_FILE_H__
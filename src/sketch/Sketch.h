@@ -1,4 +1,8 @@
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
 #include "Image.h"
+#include "BasicSketch.h"
 
 static constexpr unsigned char WHITE[4] = {255, 255, 255, 255};
 static constexpr unsigned char BLACK[4] = {0, 0, 0, 255};
@@ -58,21 +62,17 @@ struct Colour
 	}
 };
 
+// Runtime-format front end: every operation picks the BasicSketch
+// specialisation matching bytespp (1, 3 or 4) and runs it on the buffer.
 class Sketch : public Image
 {
-private:
-	bool oct1(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct2(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct3(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct4(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct5(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct6(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct7(int x0, int y0, int x1, int y1, Colour colour);
-	bool oct8(int x0, int y0, int x1, int y1, Colour colour);
-  
 public:
   using Image::Image;
+  Sketch() {}
+  Sketch(const Image &img) : Image(img) {}
 
+  // Sets every pixel to colour.
+  bool fill(Colour colour);
   bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -84,8 +84,19 @@ public:
 
 	bool draw_triangle(Vector2i t0, Vector2i t1, Vector2i t2, Colour colour);
 
-  bool draw_image(Sketch sketch, int x_anchor, int y_anchor);
+  bool draw_image(const Sketch &sketch, int x_anchor, int y_anchor);
+
+	// Replaces the 4-connected region of pixels matching the one at (x, y)
+	// with colour.
+	bool flood_fill(int x, int y, Colour colour);
+
+	// Draws text in the built-in bitmap font (see Text.h) with its top left
+	// corner at (x, y), blending by the colour's alpha. For many labels a
+	// TextBatch is faster.
+	bool draw_text(int x, int y, const char *text, Colour colour, int scale = 1);
 
-	Colour get(int x, int y);
+	Colour get(int x, int y) const;
 	bool set(int x, int y, Colour c);
-};
\ No newline at end of file
+};
+
+#endif //__SKETCH_H__
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "Text.h"
+
+// Rows of each glyph from the top, bit 4 the leftmost column.
+static const uint8_t GLYPHS[FONT_LAST_CHAR - FONT_FIRST_CHAR + 1][FONT_GLYPH_HEIGHT] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// ' '
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04, 0x00},	// '!'
+	{0x0a, 0x0a, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00},	// '"'
+	{0x0a, 0x0a, 0x1f, 0x0a, 0x1f, 0x0a, 0x0a, 0x00},	// '#'
+	{0x04, 0x0f, 0x14, 0x0e, 0x05, 0x1e, 0x04, 0x00},	// '$'
+	{0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03, 0x00},	// '%'
+	{0x0c, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0d, 0x00},	// '&'
+	{0x04, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00},	// '\''
+	{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02, 0x00},	// '('
+	{0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08, 0x00},	// ')'
+	{0x00, 0x04, 0x15, 0x0e, 0x15, 0x04, 0x00, 0x00},	// '*'
+	{0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00, 0x00},	// '+'
+	{0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08, 0x00},	// ','
+	{0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00, 0x00},	// '-'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c, 0x00},	// '.'
+	{0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00, 0x00},	// '/'
+	{0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e, 0x00},	// '0'
+	{0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00},	// '1'
+	{0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f, 0x00},	// '2'
+	{0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e, 0x00},	// '3'
+	{0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02, 0x00},	// '4'
+	{0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e, 0x00},	// '5'
+	{0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e, 0x00},	// '6'
+	{0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08, 0x00},	// '7'
+	{0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e, 0x00},	// '8'
+	{0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c, 0x00},	// '9'
+	{0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00, 0x00},	// ':'
+	{0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x04, 0x08, 0x00},	// ';'
+	{0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02, 0x00},	// '<'
+	{0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00, 0x00},	// '='
+	{0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08, 0x00},	// '>'
+	{0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04, 0x00},	// '?'
+	{0x0e, 0x11, 0x01, 0x0d, 0x15, 0x15, 0x0e, 0x00},	// '@'
+	{0x0e, 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x00},	// 'A'
+	{0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e, 0x00},	// 'B'
+	{0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e, 0x00},	// 'C'
+	{0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c, 0x00},	// 'D'
+	{0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f, 0x00},	// 'E'
+	{0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10, 0x00},	// 'F'
+	{0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f, 0x00},	// 'G'
+	{0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11, 0x00},	// 'H'
+	{0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00},	// 'I'
+	{0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c, 0x00},	// 'J'
+	{0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11, 0x00},	// 'K'
+	{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f, 0x00},	// 'L'
+	{0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11, 0x00},	// 'M'
+	{0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11, 0x00},	// 'N'
+	{0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e, 0x00},	// 'O'
+	{0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10, 0x00},	// 'P'
+	{0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d, 0x00},	// 'Q'
+	{0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11, 0x00},	// 'R'
+	{0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e, 0x00},	// 'S'
+	{0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00},	// 'T'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e, 0x00},	// 'U'
+	{0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04, 0x00},	// 'V'
+	{0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a, 0x00},	// 'W'
+	{0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11, 0x00},	// 'X'
+	{0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x00},	// 'Y'
+	{0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f, 0x00},	// 'Z'
+	{0x0e, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0e, 0x00},	// '['
+	{0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00},	// '\\'
+	{0x0e, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0e, 0x00},	// ']'
+	{0x04, 0x0a, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00},	// '^'
+	{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1f, 0x00},	// '_'
+	{0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00},	// '`'
+	{0x00, 0x00, 0x0e, 0x01, 0x0f, 0x11, 0x0f, 0x00},	// 'a'
+	{0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1e, 0x00},	// 'b'
+	{0x00, 0x00, 0x0e, 0x10, 0x10, 0x11, 0x0e, 0x00},	// 'c'
+	{0x01, 0x01, 0x0d, 0x13, 0x11, 0x11, 0x0f, 0x00},	// 'd'
+	{0x00, 0x00, 0x0e, 0x11, 0x1f, 0x10, 0x0e, 0x00},	// 'e'
+	{0x06, 0x09, 0x08, 0x1c, 0x08, 0x08, 0x08, 0x00},	// 'f'
+	{0x00, 0x00, 0x0f, 0x11, 0x11, 0x0f, 0x01, 0x0e},	// 'g'
+	{0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00},	// 'h'
+	{0x04, 0x00, 0x0c, 0x04, 0x04, 0x04, 0x0e, 0x00},	// 'i'
+	{0x02, 0x00, 0x06, 0x02, 0x02, 0x02, 0x12, 0x0c},	// 'j'
+	{0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12, 0x00},	// 'k'
+	{0x0c, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e, 0x00},	// 'l'
+	{0x00, 0x00, 0x1a, 0x15, 0x15, 0x11, 0x11, 0x00},	// 'm'
+	{0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11, 0x00},	// 'n'
+	{0x00, 0x00, 0x0e, 0x11, 0x11, 0x11, 0x0e, 0x00},	// 'o'
+	{0x00, 0x00, 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10},	// 'p'
+	{0x00, 0x00, 0x0f, 0x11, 0x11, 0x0f, 0x01, 0x01},	// 'q'
+	{0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10, 0x00},	// 'r'
+	{0x00, 0x00, 0x0e, 0x10, 0x0e, 0x01, 0x1e, 0x00},	// 's'
+	{0x08, 0x08, 0x1c, 0x08, 0x08, 0x09, 0x06, 0x00},	// 't'
+	{0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0d, 0x00},	// 'u'
+	{0x00, 0x00, 0x11, 0x11, 0x11, 0x0a, 0x04, 0x00},	// 'v'
+	{0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0a, 0x00},	// 'w'
+	{0x00, 0x00, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x00},	// 'x'
+	{0x00, 0x00, 0x11, 0x11, 0x11, 0x0f, 0x01, 0x0e},	// 'y'
+	{0x00, 0x00, 0x1f, 0x02, 0x04, 0x08, 0x1f, 0x00},	// 'z'
+	{0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02, 0x00},	// '{'
+	{0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x00},	// '|'
+	{0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08, 0x00},	// '}'
+	{0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00},	// '~'
+};
+
+GlyphAtlas::GlyphAtlas(int scale) : scale(std::max(scale, 1))
+{
+	int count = FONT_LAST_CHAR - FONT_FIRST_CHAR + 1;
+	int rows = (count + FONT_ATLAS_COLUMNS - 1) / FONT_ATLAS_COLUMNS;
+	int cw = FONT_GLYPH_WIDTH * this->scale;
+	int ch = FONT_GLYPH_HEIGHT * this->scale;
+	atlas = Image(rows * ch, FONT_ATLAS_COLUMNS * cw, Image::GRAYSCALE);
+	atlas.set_Palette(Image::PaletteDefault::BIT8);
+	uint8_t *data = atlas.buffer();
+	size_t stride = atlas.get_stride();
+	for (int i = 0; i < count; i++)
+	{
+		uint8_t *cell = data + (size_t)(i / FONT_ATLAS_COLUMNS) * ch * stride + (i % FONT_ATLAS_COLUMNS) * cw;
+		for (int y = 0; y < ch; y++)
+		{
+			uint8_t bits = GLYPHS[i][y / this->scale];
+			uint8_t *row = cell + y * stride;
+			for (int x = 0; x < cw; x++)
+				row[x] = bits & (0x10 >> (x / this->scale)) ? 255 : 0;
+		}
+	}
+}
+
+const GlyphAtlas &GlyphAtlas::shared(int scale)
+{
+	static std::mutex lock;
+	static std::map<int, std::unique_ptr<GlyphAtlas>> atlases;
+	std::lock_guard<std::mutex> guard(lock);
+	std::unique_ptr<GlyphAtlas> &atlas = atlases[scale];
+	if (!atlas)
+		atlas.reset(new GlyphAtlas(scale));
+	return *atlas;
+}
+
+MaskBlit GlyphAtlas::glyph(char c) const
+{
+	int i = (unsigned char)c;
+	if (i < FONT_FIRST_CHAR || i > FONT_LAST_CHAR)
+		i = '?';
+	i -= FONT_FIRST_CHAR;
+	MaskBlit b;
+	b.w = FONT_GLYPH_WIDTH * scale;
+	b.h = FONT_GLYPH_HEIGHT * scale;
+	b.sx = (i % FONT_ATLAS_COLUMNS) * b.w;
+	b.sy = (i / FONT_ATLAS_COLUMNS) * b.h;
+	b.dx = 0;
+	b.dy = 0;
+	return b;
+}
+
+void GlyphAtlas::layout(const char *text, int x, int y, std::vector<MaskBlit> &blits) const
+{
+	int pen = x;
+	for (const char *p = text; *p; p++)
+	{
+		if (*p == '\n')
+		{
+			pen = x;
+			y += line_height();
+			continue;
+		}
+		if (*p != ' ')
+		{
+			MaskBlit b = glyph(*p);
+			b.dx = pen;
+			b.dy = y;
+			blits.push_back(b);
+		}
+		pen += advance();
+	}
+}
+
+void GlyphAtlas::measure(const char *text, int &w, int &h) const
+{
+	int line = 0;
+	w = 0;
+	h = *text ? line_height() : 0;
+	for (const char *p = text; *p; p++)
+	{
+		if (*p == '\n')
+		{
+			line = 0;
+			h += line_height();
+			continue;
+		}
+		line += advance();
+		w = std::max(w, line);
+	}
+}
+
+bool TextBatch::draw(Image &dst, const uint8_t *colour) const
+{
+	return composite_masks(dst, atlas.image(), blits.empty() ? NULL : &blits[0], blits.size(), colour);
+}
@@ -0,0 +1,77 @@
+#ifndef __TEXT_H__
+#define __TEXT_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "Composite.h"
+#include "Image.h"
+
+// Text in an embedded 5 x 7 bitmap font covering printable ASCII, with one
+// row below the baseline for descenders. Other characters draw as '?'.
+#define FONT_FIRST_CHAR     32
+#define FONT_LAST_CHAR      126
+#define FONT_GLYPH_WIDTH    5
+#define FONT_GLYPH_HEIGHT   8
+#define FONT_ADVANCE        6
+#define FONT_LINE_HEIGHT    9
+#define FONT_ATLAS_COLUMNS  16
+
+// Every glyph of the font rasterised once, at an integer scale, into an
+// 8-bit coverage mask for composite_masks.
+class GlyphAtlas
+{
+	Image atlas;
+	int scale;
+
+public:
+	explicit GlyphAtlas(int scale = 1);
+
+	// One atlas per scale, built on first use and kept for the life of the
+	// program. Safe to call from several threads.
+	static const GlyphAtlas &shared(int scale);
+
+	const Image &image() const { return atlas; }
+	int advance() const { return FONT_ADVANCE * scale; }
+	int line_height() const { return FONT_LINE_HEIGHT * scale; }
+
+	// The atlas rectangle of c, placed at the origin.
+	MaskBlit glyph(char c) const;
+	// Appends a blit per visible character of text with its top left corner
+	// at (x, y). '\n' starts a new line back at x.
+	void layout(const char *text, int x, int y, std::vector<MaskBlit> &blits) const;
+	// Width of the longest line and the height of all lines of text.
+	void measure(const char *text, int &w, int &h) const;
+};
+
+// Collects the glyphs of many strings so they are drawn in one pass.
+class TextBatch
+{
+	const GlyphAtlas &atlas;
+	std::vector<MaskBlit> blits;
+
+public:
+	explicit TextBatch(const GlyphAtlas &atlas) : atlas(atlas)
+	{
+	}
+
+	void add(int x, int y, const char *text)
+	{
+		atlas.layout(text, x, y, blits);
+	}
+
+	void clear()
+	{
+		blits.clear();
+	}
+
+	size_t size() const
+	{
+		return blits.size();
+	}
+
+	// Blends colour, RGBA with straight alpha, through every glyph added.
+	bool draw(Image &dst, const uint8_t *colour) const;
+};
+
+#endif //__TEXT_H__
@@ -0,0 +1,224 @@
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Compare.h"
+#include "Lut.h"
+#include "Parallel.h"
+#include "Sketch.h"
+
+// Compares rendered BMPs against goldens.
+//
+//   image_diff [options] <golden.bmp> <actual.bmp>
+//   image_diff [options] --dirs <golden_dir> <actual_dir>
+//
+// Options:
+//   --tolerance <n>     largest absolute channel error that still passes (0)
+//   --min-psnr <db>     fail below this overall PSNR
+//   --min-ssim <s>      fail below this SSIM
+//   --heatmap <path>    write a heatmap of the differences of failing pairs;
+//                       a directory in --dirs mode
+//
+// Exits with 0 when every pair passes, 1 when any pair fails and 2 on usage
+// or I/O errors.
+
+#define LEGEND_HEIGHT   12
+
+struct Options
+{
+	int tolerance;
+	double min_psnr;
+	double min_ssim;
+	const char *heatmap;
+
+	Options() : tolerance(0), min_psnr(0.0), min_ssim(-1.0), heatmap(NULL)
+	{
+	}
+};
+
+struct Outcome
+{
+	std::string name;
+	bool ok;				// Both files could be read and compared
+	bool pass;
+	CompareResult result;
+};
+
+static bool passes(const CompareResult &r, const Options &opt)
+{
+	for (int c = 0; c < r.channels; c++)
+		if (r.max_error[c] > opt.tolerance)
+			return false;
+	return r.psnr_total >= opt.min_psnr && r.ssim >= opt.min_ssim;
+}
+
+// Black -> red -> yellow -> white as t goes from 0 to 1.
+static Colour ramp(double t)
+{
+	t = std::min(1.0, std::max(0.0, t)) * 3.0;
+	uint8_t r = (uint8_t)(255 * std::min(1.0, t));
+	uint8_t g = (uint8_t)(255 * std::min(1.0, std::max(0.0, t - 1.0)));
+	uint8_t b = (uint8_t)(255 * std::max(0.0, t - 2.0));
+	return Colour(r, g, b, 255);
+}
+
+// The per-pixel error, scaled so the largest error is white, above a legend
+// strip showing the ramp from 0 to that error.
+static bool write_heatmap(Image &a, Image &b, int max_error, const char *path)
+{
+	Image diff;
+	if (!diff_map(a, b, diff))
+		return false;
+
+	uint8_t lut[RGBAQUAD][NUM_COLORS];
+	for (int i = 0; i < NUM_COLORS; i++)
+	{
+		Colour c = ramp((double)i / std::max(1, max_error));
+		for (int ch = 0; ch < RGBAQUAD; ch++)
+			lut[ch][i] = c.raw[ch];
+	}
+	diff.to_rgb();
+	ColourLut().map(lut[0], CHANNEL_R).map(lut[1], CHANNEL_G).map(lut[2], CHANNEL_B).apply(diff);
+
+	int w = diff.get_width();
+	int h = diff.get_height();
+	Sketch heat(h + LEGEND_HEIGHT, w, Image::RGB);
+	memcpy(heat.buffer(), diff.buffer(), (size_t)w * h * Image::RGB);
+	heat.draw_line(0, h, w, h, Colour(255, 255, 255, 255));
+	for (int x = 0; x < w; x++)
+		heat.draw_line(x, h + 2, x, h + LEGEND_HEIGHT, ramp((double)x / std::max(1, w - 1)));
+	heat.write_bmp(path);
+	return true;
+}
+
+static Outcome run(const std::string &name, const std::string &golden, const std::string &actual,
+                   const Options &opt, const std::string &heatmap)
+{
+	Outcome out;
+	out.name = name;
+	out.ok = compare_files(golden.c_str(), actual.c_str(), out.result);
+	out.pass = out.ok && passes(out.result, opt);
+	if (out.ok && !out.pass && !heatmap.empty() && out.result.differing_pixels)
+	{
+		Image a, b;
+		a.read_bmp(golden.c_str());
+		b.read_bmp(actual.c_str());
+		int max_error = 0;
+		for (int c = 0; c < out.result.channels; c++)
+			max_error = std::max(max_error, out.result.max_error[c]);
+		write_heatmap(a, b, max_error, heatmap.c_str());
+	}
+	return out;
+}
+
+static void print(const Outcome &o)
+{
+	if (!o.ok)
+	{
+		printf("%s  ERROR\n", o.name.c_str());
+		return;
+	}
+	const CompareResult &r = o.result;
+	printf("%s  max", o.name.c_str());
+	for (int c = 0; c < r.channels; c++)
+		printf("%c%d", c ? '/' : ' ', r.max_error[c]);
+	printf("  mean");
+	for (int c = 0; c < r.channels; c++)
+		printf("%c%.3f", c ? '/' : ' ', r.mean_error[c]);
+	if (isinf(r.psnr_total))
+		printf("  psnr inf");
+	else
+		printf("  psnr %.2f dB", r.psnr_total);
+	printf("  ssim %.5f  %llu px  %s\n", r.ssim, (unsigned long long)r.differing_pixels, o.pass ? "PASS" : "FAIL");
+}
+
+static bool list_bmps(const char *dir, std::vector<std::string> &names)
+{
+	DIR *d = opendir(dir);
+	if (d==NULL)
+		return false;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+	{
+		std::string s(e->d_name);
+		if (s.size() > 4 && s.compare(s.size() - 4, 4, ".bmp")==0)
+			names.push_back(s);
+	}
+	closedir(d);
+	std::sort(names.begin(), names.end());
+	return true;
+}
+
+static int usage()
+{
+	fprintf(stderr, "usage: image_diff [--tolerance n] [--min-psnr db] [--min-ssim s] [--heatmap path]\n"
+	                "                  (<golden.bmp> <actual.bmp> | --dirs <golden_dir> <actual_dir>)\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	Options opt;
+	bool dirs = false;
+	std::vector<const char *> paths;
+	for (int i = 1; i < argc; i++)
+	{
+		bool has_value = i + 1 < argc;
+		if (!strcmp(argv[i], "--dirs"))
+			dirs = true;
+		else if (!strcmp(argv[i], "--tolerance") && has_value)
+			opt.tolerance = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--min-psnr") && has_value)
+			opt.min_psnr = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--min-ssim") && has_value)
+			opt.min_ssim = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--heatmap") && has_value)
+			opt.heatmap = argv[++i];
+		else if (argv[i][0]=='-')
+			return usage();
+		else
+			paths.push_back(argv[i]);
+	}
+	if (paths.size() != 2)
+		return usage();
+
+	std::vector<Outcome> outcomes;
+	if (!dirs)
+	{
+		outcomes.push_back(run(paths[1], paths[0], paths[1], opt, opt.heatmap ? opt.heatmap : ""));
+	}
+	else
+	{
+		std::vector<std::string> names;
+		if (!list_bmps(paths[0], names))
+		{
+			fprintf(stderr, "Could not open directory %s\n", paths[0]);
+			return 2;
+		}
+		outcomes.resize(names.size());
+		parallel_bands(names.size(), [&](int begin, int end) {
+			for (int i = begin; i < end; i++)
+			{
+				std::string heatmap = opt.heatmap ? std::string(opt.heatmap) + "/" + names[i] : "";
+				outcomes[i] = run(names[i], std::string(paths[0]) + "/" + names[i],
+				                  std::string(paths[1]) + "/" + names[i], opt, heatmap);
+			}
+		}, 1);
+	}
+
+	int status = 0;
+	for (size_t i = 0; i < outcomes.size(); i++)
+	{
+		print(outcomes[i]);
+		if (!outcomes[i].ok)
+			status = 2;
+		else if (!outcomes[i].pass && status==0)
+			status = 1;
+	}
+	return status;
+}
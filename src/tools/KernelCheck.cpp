@@ -0,0 +1,189 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "Dispatch.h"
+
+// Checks every dispatched kernel at every level this CPU supports against the
+// scalar kernels, on random rows of many widths and alignments.
+//
+//   kernel_check [level]
+//
+// Only levels up to the given one, or cpu_detect(), are checked. Exits with 0
+// when every variant matches, 1 on any mismatch and 2 on usage errors.
+
+#define MAX_WIDTH   300
+#define TRIALS      4
+
+static uint32_t rng = 12345;
+
+static uint8_t random_byte()
+{
+	rng = rng * 1103515245u + 12345u;
+	return (uint8_t)(rng >> 16);
+}
+
+static void fill_random(std::vector<uint8_t> &v)
+{
+	for (size_t i = 0; i < v.size(); i++)
+		v[i] = random_byte();
+}
+
+// Random floats in [0, 1] with some exact 0 and 1 alphas mixed in, so the
+// fully transparent and fully opaque paths are taken.
+static void fill_random(std::vector<float> &v)
+{
+	for (size_t i = 0; i < v.size(); i++)
+	{
+		uint8_t b = random_byte();
+		v[i] = b < 16 ? 0.0f : (b > 240 ? 1.0f : b / 255.0f);
+	}
+}
+
+// Each check runs both tables on the same input at a few offsets into a
+// buffer with guard bytes, and fails on any output difference or on writes
+// past the row.
+struct Check
+{
+	const KernelTable &ref;
+	const KernelTable &test;
+	int failures;
+
+	Check(const KernelTable &ref, const KernelTable &test) : ref(ref), test(test), failures(0)
+	{
+	}
+
+	void fail(const char *kernel, int width, int channels)
+	{
+		if (failures++ < 10)
+			printf("  %s mismatch: width %d, channels %d\n", kernel, width, channels);
+	}
+
+	void expand_palette(int width, int offset)
+	{
+		std::vector<uint8_t> src(width + offset), palette(1024);
+		std::vector<uint8_t> a(3 * width + offset + 64, 0xCD), b(a);
+		fill_random(src);
+		fill_random(palette);
+		ref.expand_palette_row(src.data() + offset, a.data() + offset, width, palette.data());
+		test.expand_palette_row(src.data() + offset, b.data() + offset, width, palette.data());
+		if (a != b)
+			fail("expand_palette_row", width, 1);
+	}
+
+	void swap_rb(int width, int channels, int offset)
+	{
+		std::vector<uint8_t> src(channels * width + offset);
+		std::vector<uint8_t> a(channels * width + offset + 64, 0xCD), b(a);
+		fill_random(src);
+		if (channels == 3)
+		{
+			ref.swap_rb24_row(src.data() + offset, a.data() + offset, width);
+			test.swap_rb24_row(src.data() + offset, b.data() + offset, width);
+		}
+		else
+		{
+			ref.swap_rb32_row(src.data() + offset, a.data() + offset, width);
+			test.swap_rb32_row(src.data() + offset, b.data() + offset, width);
+		}
+		if (a != b)
+			fail(channels == 3 ? "swap_rb24_row" : "swap_rb32_row", width, channels);
+	}
+
+	void fill(int width, int channels, int offset)
+	{
+		uint8_t pixel[4] = {random_byte(), random_byte(), random_byte(), random_byte()};
+		std::vector<uint8_t> a(channels * width + offset + 64, 0xCD), b(a);
+		ref.fill_row(a.data() + offset, width, pixel, channels);
+		test.fill_row(b.data() + offset, width, pixel, channels);
+		if (a != b)
+			fail("fill_row", width, channels);
+	}
+
+	void blend(int width, int channels, int offset)
+	{
+		std::vector<float> src(4 * width + offset);
+		std::vector<float> a(channels * width + offset + 16);
+		fill_random(src);
+		fill_random(a);
+		std::vector<float> b(a);
+		float opacity = random_byte() < 64 ? 1.0f : random_byte() / 255.0f;
+		ref.blend_over_row(a.data() + offset, channels, src.data() + offset, width, opacity);
+		test.blend_over_row(b.data() + offset, channels, src.data() + offset, width, opacity);
+		// A variant may fuse multiply-adds, so allow for the last bit.
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (fabsf(a[i] - b[i]) > 1e-6f)
+			{
+				fail("blend_over_row", width, channels);
+				break;
+			}
+		}
+	}
+
+	void downsample(int width, int channels, int offset)
+	{
+		std::vector<uint8_t> r0(channels * width + offset), r1(r0.size());
+		std::vector<uint8_t> a(channels * ((width + 1) / 2) + offset + 64, 0xCD), b(a);
+		fill_random(r0);
+		fill_random(r1);
+		ref.downsample2x_row(r0.data() + offset, r1.data() + offset, a.data() + offset, width, channels);
+		test.downsample2x_row(r0.data() + offset, r1.data() + offset, b.data() + offset, width, channels);
+		if (a != b)
+			fail("downsample2x_row", width, channels);
+	}
+};
+
+int main(int argc, char **argv)
+{
+	CpuLevel top = cpu_detect();
+	if (argc > 2)
+	{
+		fprintf(stderr, "usage: kernel_check [level]\n");
+		return 2;
+	}
+	if (argc == 2)
+	{
+		CpuLevel level;
+		if (!parse_cpu_level(argv[1], level))
+		{
+			fprintf(stderr, "Unknown level %s\n", argv[1]);
+			return 2;
+		}
+		if (level < top)
+			top = level;
+	}
+
+	KernelTable ref = kernel_table(CPU_SCALAR);
+	int failures = 0;
+	for (int l = CPU_SSE2; l <= top; l++)
+	{
+		KernelTable test = kernel_table((CpuLevel)l);
+		if (test.level != l)
+			continue;
+
+		Check check(ref, test);
+		for (int width = 0; width <= MAX_WIDTH; width++)
+		{
+			for (int trial = 0; trial < TRIALS; trial++)
+			{
+				int offset = trial;
+				check.expand_palette(width, offset);
+				check.swap_rb(width, 3, offset);
+				check.swap_rb(width, 4, offset);
+				for (int channels = 1; channels <= 4; channels++)
+				{
+					check.fill(width, channels, offset);
+					check.downsample(width, channels, offset);
+				}
+				check.blend(width, 3, offset);
+				check.blend(width, 4, offset);
+			}
+		}
+		printf("%-8s %s\n", cpu_level_name((CpuLevel)l), check.failures ? "FAIL" : "ok");
+		failures += check.failures;
+	}
+	return failures ? 1 : 0;
+}
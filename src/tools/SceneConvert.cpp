@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include "MappedFile.h"
+#include "SceneFile.h"
+
+// Converts a text scene (see Scene.h) to the binary form in SceneFile.h,
+// optionally rendering the result as a check.
+//
+//   scene_convert <scene.txt> <scene.bin> [--render <out.bmp>]
+//
+// Exits with 0 on success, 1 when the scene is invalid and 2 on usage or I/O
+// errors.
+
+static int usage()
+{
+	fprintf(stderr, "usage: scene_convert <scene.txt> <scene.bin> [--render <out.bmp>]\n");
+	return 2;
+}
+
+int main(int argc, char **argv)
+{
+	const char *paths[2] = {NULL, NULL};
+	const char *render = NULL;
+	int npaths = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--render") && i + 1 < argc)
+			render = argv[++i];
+		else if (argv[i][0] != '-' && npaths < 2)
+			paths[npaths++] = argv[i];
+		else
+			return usage();
+	}
+	if (npaths != 2)
+		return usage();
+
+	MappedFile text;
+	if (!text.open(paths[0]))
+		return 2;
+	Scene scene;
+	std::string error;
+	if (!parse_scene((const char *)text.bytes(), text.length(), scene, error))
+	{
+		fprintf(stderr, "%s: %s\n", paths[0], error.c_str());
+		return 1;
+	}
+	if (!write_scene_file(scene, paths[1]))
+		return 2;
+
+	if (render)
+	{
+		SceneFile file;
+		if (!file.open(paths[1], error))
+		{
+			fprintf(stderr, "%s: %s\n", paths[1], error.c_str());
+			return 1;
+		}
+		Sketch canvas(scene.height, scene.width, scene.bytespp);
+		if (!render_scene(file, canvas, error))
+		{
+			fprintf(stderr, "%s: %s\n", paths[1], error.c_str());
+			return 1;
+		}
+		canvas.write_bmp(render);
+	}
+	return 0;
+}
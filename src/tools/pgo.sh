@@ -0,0 +1,51 @@
+#!/bin/bash
+# Builds profile-guided optimised binaries, trained on the benchmark suite.
+# Run from the workspace root:
+#
+#   src/tools/pgo.sh [targets...]
+#
+# With no targets it builds the benchmark, main and the render server. The
+# profile is left in $PGO_DIR (default /tmp/paintmeapicture-pgo). Then it
+# benchmarks the plain --config=opt build and the PGO build, writing
+# opt.json and pgo.json there for compare.py.
+#
+# The training filter covers every operation at mid sizes. Set
+# PGO_FILTER to train on something closer to your own workload.
+
+set -e
+
+PGO_DIR=${PGO_DIR:-/tmp/paintmeapicture-pgo}
+PGO_FILTER=${PGO_FILTER:-/(64|256|1024)/}
+BENCH=//src/bench:image_benchmark
+TARGETS=("$@")
+if [ ${#TARGETS[@]} -eq 0 ]; then
+	TARGETS=($BENCH //src/main:main //src/server:render_server)
+fi
+
+rm -rf "$PGO_DIR"
+mkdir -p "$PGO_DIR"
+
+echo "== Instrumented build"
+bazel build --config=pgo --fdo_instrument="$PGO_DIR" $BENCH
+BIN=$(bazel cquery --config=pgo --fdo_instrument="$PGO_DIR" --output=files $BENCH 2>/dev/null)
+
+echo "== Training"
+LLVM_PROFILE_FILE="$PGO_DIR/bench-%p.profraw" "$BIN" \
+	--benchmark_filter="$PGO_FILTER" --benchmark_min_time=0.05s > /dev/null
+llvm-profdata merge -o "$PGO_DIR/merged.profdata" "$PGO_DIR"/*.profraw
+
+echo "== Baseline"
+bazel build --config=pgo $BENCH
+BIN=$(bazel cquery --config=pgo --output=files $BENCH 2>/dev/null)
+"$BIN" --benchmark_filter="$PGO_FILTER" --benchmark_repetitions=3 \
+	--benchmark_report_aggregates_only=true \
+	--benchmark_out="$PGO_DIR/opt.json" --benchmark_out_format=json > /dev/null
+
+echo "== Optimised build"
+bazel build --config=pgo --fdo_optimize="$PGO_DIR/merged.profdata" "${TARGETS[@]}"
+BIN=$(bazel cquery --config=pgo --fdo_optimize="$PGO_DIR/merged.profdata" --output=files $BENCH 2>/dev/null)
+"$BIN" --benchmark_filter="$PGO_FILTER" --benchmark_repetitions=3 \
+	--benchmark_report_aggregates_only=true \
+	--benchmark_out="$PGO_DIR/pgo.json" --benchmark_out_format=json > /dev/null
+
+echo "Profile and results in $PGO_DIR"